@@ -0,0 +1,66 @@
+#include <EventLoop.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+// Ping-pong over pipes: every read end writes its byte back into its own
+// pipe, so a tenth of the pipes stay busy while the rest sit idle in the
+// set, the way most of rdm's connections do. 1000 pending timers keep the
+// timer heap honest.
+// usage: eventloopbench [fds] [events] (default 1000 2000000)
+
+static long long sHandled = 0;
+static long long sTarget = 0;
+
+static void onReadable(int fd, unsigned int, void *userData)
+{
+    char c;
+    if (read(fd, &c, 1) == 1) {
+        ++sHandled;
+        const int writeFd = static_cast<int>(reinterpret_cast<long>(userData));
+        if (write(writeFd, &c, 1) != 1)
+            perror("write");
+    }
+    if (sHandled >= sTarget)
+        EventLoop::instance()->exit();
+}
+
+static void onTimer(int, void *)
+{
+}
+
+int main(int argc, char **argv)
+{
+    const int count = argc > 1 ? atoi(argv[1]) : 1000;
+    sTarget = argc > 2 ? atoll(argv[2]) : 2000000;
+
+    EventLoop loop;
+    List<int> writeFds(count);
+    for (int i=0; i<count; ++i) {
+        int pipes[2];
+        if (pipe(pipes)) {
+            perror("pipe");
+            return 1;
+        }
+        fcntl(pipes[0], F_SETFL, O_NONBLOCK);
+        writeFds[i] = pipes[1];
+        loop.addFileDescriptor(pipes[0], EventLoop::Read, onReadable, reinterpret_cast<void*>(static_cast<long>(pipes[1])));
+    }
+    for (int i=0; i<1000; ++i)
+        loop.addTimer(60000 + i, onTimer, 0);
+    for (int i=0; i<count; i += 10) {
+        const char c = 'x';
+        if (write(writeFds.at(i), &c, 1) != 1)
+            perror("write");
+    }
+
+    timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    loop.run();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const double secs = (end.tv_sec - start.tv_sec) + ((end.tv_nsec - start.tv_nsec) / 1000000000.0);
+    printf("%d fds: %lld events in %.2fs, %.0f events/sec\n", count, sHandled, secs, sHandled / secs);
+    return 0;
+}
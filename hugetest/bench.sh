@@ -0,0 +1,36 @@
+#!/bin/sh
+
+# Times a full index of the hugetest corpus with the AST visitor and with
+# the clang_indexSourceFile backend (rdm -u).
+# usage: bench.sh [bindir] (default ../bin)
+
+BIN=`cd ${1:-\`dirname $0\`/../bin} && pwd`
+DIR=`mktemp -d /tmp/hugetest.XXXXXX`
+HERE=`cd \`dirname $0\` && pwd`
+cd $DIR || exit 1
+sh $HERE/script.sh > /dev/null
+
+echo "[" > compile_commands.json
+for i in `seq 1 1000`; do
+    [ $i -gt 1 ] && echo "," >> compile_commands.json
+    printf '{ "directory": "%s", "command": "g++ -c %s.cpp", "file": "%s.cpp" }' $DIR $i $i >> compile_commands.json
+done
+echo "]" >> compile_commands.json
+
+run()
+{
+    rm -rf $DIR/data
+    $BIN/rdm -N -C -S -n $DIR/sock -d $DIR/data -L $DIR/rdm$1.log $2 &
+    while [ ! -S $DIR/sock ]; do sleep 0.1; done
+    START=`date +%s.%N`
+    $BIN/rc -n $DIR/sock -m $DIR/compile_commands.json > /dev/null
+    $BIN/rc -n $DIR/sock -X -T $DIR/1.cpp > /dev/null
+    END=`date +%s.%N`
+    echo "$3: `echo "$END - $START" | bc` secs, `grep "Jobs took" $DIR/rdm$1.log | tail -1`"
+    $BIN/rc -n $DIR/sock -q > /dev/null
+    wait
+}
+
+run 1 "" "visitor  "
+run 2 -u "index-api"
+rm -rf $DIR
@@ -62,6 +62,63 @@
   (let ((result (if rtags-path (concat rtags-path "/" exe) (executable-find exe))))
     (if (file-exists-p result) result nil)))
 
+(defvar rtags-rc-server-process nil)
+(defvar rtags-rc-server-request-id 0)
+(defvar rtags-rc-server-responses (make-hash-table))
+(defvar rtags-rc-server-output "")
+
+(defun rtags-rc-server-filter (process output)
+  ;; lines are "<id>:<text>" and "<id>." once request <id> is done
+  (setq rtags-rc-server-output (concat rtags-rc-server-output output))
+  (let ((start 0) end)
+    (while (setq end (string-match "\n" rtags-rc-server-output start))
+      (let ((line (substring rtags-rc-server-output start end)))
+        (if (string-match "^\\([0-9]+\\)\\([:.]\\)" line)
+            (let ((response (gethash (string-to-number (match-string 1 line)) rtags-rc-server-responses)))
+              (if response
+                  (if (string= (match-string 2 line) ".")
+                      (setcar response t)
+                    (setcdr response (cons (substring line (match-end 0)) (cdr response))))))))
+      (setq start (1+ end)))
+    (setq rtags-rc-server-output (substring rtags-rc-server-output start))))
+
+(defun rtags-rc-server-process (rc)
+  (unless (and rtags-rc-server-process (eq (process-status rtags-rc-server-process) 'run))
+    (let ((process-connection-type nil))
+      (setq rtags-rc-server-output ""
+            rtags-rc-server-process (apply #'start-process "RTags rc" nil rc "--server"
+                                           (if rtags-autostart-rdm (list "--autostart-rdm"))))
+      (clrhash rtags-rc-server-responses)
+      (set-process-query-on-exit-flag rtags-rc-server-process nil)
+      (set-process-filter rtags-rc-server-process 'rtags-rc-server-filter)))
+  rtags-rc-server-process)
+
+;; rc --server only runs queries, these need an rc of their own
+(defconst rtags-rc-server-unsupported-switches
+  '("-m" "--makefile" "-t" "--grtag" "-j" "--smart-project"
+    "-g" "--rdm-log" "-G" "--diagnostics" "-u" "--unsaved-file"))
+
+(defun rtags-rc-server-supports (arguments)
+  (let ((supported t))
+    (dolist (argument arguments supported)
+      (if (member (car (split-string argument "=")) rtags-rc-server-unsupported-switches)
+          (setq supported nil)))))
+
+(defun rtags-call-rc-server (rc arguments)
+  (let* ((process (rtags-rc-server-process rc))
+         (id (setq rtags-rc-server-request-id (1+ rtags-rc-server-request-id)))
+         (response (list nil))
+         (deadline (if rtags-timeout (+ (float-time) (/ rtags-timeout 1000.0)))))
+    (puthash id response rtags-rc-server-responses)
+    (process-send-string process (format "%d %s\n" id (combine-and-quote-strings arguments)))
+    (while (and (not (car response))
+                (eq (process-status process) 'run)
+                (or (not deadline) (< (float-time) deadline)))
+      (accept-process-output process 0.1))
+    (remhash id rtags-rc-server-responses)
+    (dolist (line (nreverse (cdr response)))
+      (insert line "\n"))))
+
 (defun rtags-call-rc (path &rest arguments)
   (let ((rc (rtags-executable-find "rc")))
     (if rc
@@ -80,7 +137,9 @@
               (push (concat "--project=" path) arguments))
 
           (rtags-log (concat rc " " (combine-and-quote-strings arguments)))
-          (apply #'call-process rc nil (list t nil) nil arguments)
+          (if (and rtags-rc-server (rtags-rc-server-supports arguments))
+              (rtags-call-rc-server rc arguments)
+            (apply #'call-process rc nil (list t nil) nil arguments))
           (goto-char (point-min))
           (rtags-log (buffer-string))
           (> (point-max) (point-min))))))
@@ -136,6 +195,94 @@
     )
   )
 
+(defvar rtags-unsaved-buffer-tick nil)
+(make-variable-buffer-local 'rtags-unsaved-buffer-tick)
+
+(defun rtags-buffer-contents (&optional buffer)
+  (with-current-buffer (or buffer (current-buffer))
+    (save-restriction
+      (widen)
+      (encode-coding-string (buffer-substring-no-properties (point-min) (point-max))
+                            buffer-file-coding-system))))
+
+(defun rtags-update-unsaved-buffer (&optional buffer)
+  (interactive)
+  (let ((path (buffer-file-name buffer))
+        (rc (rtags-executable-find "rc")))
+    (if (and path rc)
+        (let ((contents (rtags-buffer-contents buffer)))
+          (with-current-buffer (or buffer (current-buffer))
+            (setq rtags-unsaved-buffer-tick (buffer-modified-tick)))
+          (with-temp-buffer
+            (set-buffer-multibyte nil)
+            (insert contents)
+            (rtags-log (format "%s -u %s:%d" rc path (length contents)))
+            (call-process-region (point-min) (point-max) rc nil nil nil
+                                 "-u" (format "%s:%d" path (length contents))))))
+    )
+  )
+
+(defun rtags-clear-unsaved-buffer (&optional buffer)
+  "Tell rdm to forget what rtags-update-unsaved-buffer sent for BUFFER"
+  (interactive)
+  (with-current-buffer (or buffer (current-buffer))
+    (let ((path (buffer-file-name))
+          (rc (rtags-executable-find "rc")))
+      (if (and rtags-unsaved-buffer-tick path rc)
+          (progn
+            (setq rtags-unsaved-buffer-tick nil)
+            (rtags-log (format "%s --clear-unsaved-file %s" rc path))
+            (call-process rc nil 0 nil "--clear-unsaved-file" path))))))
+
+(defun rtags-update-unsaved-buffer-on-idle ()
+  (if (and (buffer-file-name)
+           (buffer-modified-p)
+           (not (eq rtags-unsaved-buffer-tick (buffer-modified-tick)))
+           (or (eq major-mode 'c++-mode) (eq major-mode 'c-mode)))
+      (rtags-update-unsaved-buffer)))
+
+(defun rtags-complete-at-point ()
+  "Completion function for completion-at-point-functions using rc --code-complete-at"
+  (let ((path (buffer-file-name))
+        (rc (rtags-executable-find "rc"))
+        (start (save-excursion (skip-chars-backward "A-Za-z0-9_") (point)))
+        (candidates nil))
+    (if (and path rc)
+        (let ((contents (rtags-buffer-contents))
+              (location (format "%s,%d" path (- start 1))))
+          ;; -u leaves the contents with rdm too
+          (setq rtags-unsaved-buffer-tick (buffer-modified-tick))
+          (with-temp-buffer
+            (set-buffer-multibyte nil)
+            (insert contents)
+            (rtags-log (format "%s -u %s:%d -b %s" rc path (length contents) location))
+            (call-process-region (point-min) (point-max) rc t t nil
+                                 "-u" (format "%s:%d" path (length contents))
+                                 "-b" location)
+            (goto-char (point-min))
+            (while (not (eobp))
+              (if (looking-at "\\([^ \n]+\\) ")
+                  (push (match-string 1) candidates))
+              (forward-line)))
+          (list start (point) (delete-dups (nreverse candidates)))))
+    )
+  )
+
+(defvar rtags-unsaved-buffer-timer nil)
+(defun rtags-enable-unsaved-buffer-indexing (&optional disable)
+  (interactive "P")
+  (if rtags-unsaved-buffer-timer
+      (cancel-timer rtags-unsaved-buffer-timer))
+  (setq rtags-unsaved-buffer-timer
+        (if disable nil
+          (run-with-idle-timer rtags-unsaved-buffer-idle-delay t 'rtags-update-unsaved-buffer-on-idle)))
+  ;; rdm keeps the contents until told otherwise
+  (dolist (hook '(after-save-hook after-revert-hook kill-buffer-hook))
+    (if disable
+        (remove-hook hook 'rtags-clear-unsaved-buffer)
+      (add-hook hook 'rtags-clear-unsaved-buffer)))
+  )
+
 (defun rtags-set-current-project ()
   (interactive)
   (let ((projects nil)
@@ -443,6 +590,16 @@ return t if rtags is allowed to modify this file"
   :group 'rtags
   :type 'boolean)
 
+(defcustom rtags-rc-server nil
+  "If t, send requests to one long running rc --server instead of starting rc for each"
+  :group 'rtags
+  :type 'boolean)
+
+(defcustom rtags-unsaved-buffer-idle-delay 0.5
+  "Seconds of idle time before a modified buffer is sent to rdm for reindexing"
+  :group 'rtags
+  :type 'number)
+
 
 (defun rtags-enable-standard-keybindings (&optional map)
   (interactive)
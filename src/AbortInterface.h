@@ -15,7 +15,7 @@ public:
     virtual ~AbortInterface()
     {}
 
-    inline void abort()
+    virtual void abort()
     {
         MutexLocker lock(&mMutex);
         mAborted = true;
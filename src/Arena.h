@@ -0,0 +1,130 @@
+#ifndef Arena_h
+#define Arena_h
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <new>
+#include <utility>
+
+// Monotonic allocator. Nothing is freed until the arena is cleared or
+// destroyed, which releases every chunk at once.
+class Arena
+{
+public:
+    enum { ChunkSize = 64 * 1024 };
+
+    Arena()
+        : mChunks(0), mPos(0), mEnd(0), mSize(0)
+    {}
+    ~Arena() { clear(); }
+
+    void *alloc(int size, int align = sizeof(void*))
+    {
+        char *ret = aligned(mPos, align);
+        if (!ret || ret + size > mEnd) {
+            addChunk(size + align);
+            ret = aligned(mPos, align);
+        }
+        mPos = ret + size;
+        return ret;
+    }
+
+    char *strdup(const char *str, int length)
+    {
+        char *ret = static_cast<char*>(alloc(length + 1, 1));
+        memcpy(ret, str, length);
+        ret[length] = '\0';
+        return ret;
+    }
+
+    void clear()
+    {
+        while (mChunks) {
+            Chunk *next = mChunks->next;
+            free(mChunks);
+            mChunks = next;
+        }
+        mPos = mEnd = 0;
+        mSize = 0;
+    }
+
+    int size() const { return mSize; }
+private:
+    Arena(const Arena &);
+    Arena &operator=(const Arena &);
+
+    static char *aligned(char *pos, int align)
+    {
+        if (!pos)
+            return 0;
+        const uintptr_t p = reinterpret_cast<uintptr_t>(pos);
+        return reinterpret_cast<char*>((p + align - 1) & ~uintptr_t(align - 1));
+    }
+
+    void addChunk(int minimum)
+    {
+        const int size = minimum > ChunkSize ? minimum : ChunkSize;
+        Chunk *chunk = static_cast<Chunk*>(malloc(sizeof(Chunk) + size));
+        chunk->next = mChunks;
+        mChunks = chunk;
+        mPos = reinterpret_cast<char*>(chunk + 1);
+        mEnd = mPos + size;
+        mSize += size;
+    }
+
+    struct Chunk {
+        Chunk *next;
+    };
+    Chunk *mChunks;
+    char *mPos, *mEnd;
+    int mSize;
+};
+
+// Lets standard containers allocate their nodes from an Arena. Deallocation
+// is a no-op, the arena must outlive the container.
+template <typename T>
+class ArenaAllocator
+{
+public:
+    typedef T value_type;
+    typedef T *pointer;
+    typedef const T *const_pointer;
+    typedef T &reference;
+    typedef const T &const_reference;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+    template <typename U> struct rebind { typedef ArenaAllocator<U> other; };
+
+    explicit ArenaAllocator(Arena *arena)
+        : mArena(arena)
+    {}
+    template <typename U> ArenaAllocator(const ArenaAllocator<U> &other)
+        : mArena(other.arena())
+    {}
+
+    pointer allocate(size_type count, const void * = 0)
+    {
+        return static_cast<pointer>(mArena->alloc(count * sizeof(T), __alignof__(T)));
+    }
+    void deallocate(pointer, size_type) {}
+
+    template <typename U, typename... Args> void construct(U *p, Args&&... args)
+    {
+        new (p) U(std::forward<Args>(args)...);
+    }
+    template <typename U> void destroy(U *p) { p->~U(); }
+
+    size_type max_size() const { return size_type(-1) / sizeof(T); }
+    pointer address(reference r) const { return &r; }
+    const_pointer address(const_reference r) const { return &r; }
+
+    Arena *arena() const { return mArena; }
+    template <typename U> bool operator==(const ArenaAllocator<U> &other) const { return mArena == other.arena(); }
+    template <typename U> bool operator!=(const ArenaAllocator<U> &other) const { return mArena != other.arena(); }
+private:
+    Arena *mArena;
+};
+
+#endif
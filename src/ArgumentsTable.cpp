@@ -0,0 +1,60 @@
+#include "ArgumentsTable.h"
+#include "RTags.h"
+#include "ReadLocker.h"
+#include "WriteLocker.h"
+
+ReadWriteLock ArgumentsTable::sLock;
+std::unordered_multimap<uint64_t, uint32_t> ArgumentsTable::sIds;
+List<const List<ByteArray>*> ArgumentsTable::sLists(1, new List<ByteArray>);
+
+uint64_t ArgumentsTable::hash(const List<ByteArray> &args)
+{
+    // with the terminating nulls so "-DA" "B" and "-DAB" differ
+    uint64_t ret = RTags::FNVOffsetBasis;
+    const int count = args.size();
+    for (int i=0; i<count; ++i) {
+        const ByteArray &arg = args.at(i);
+        ret = RTags::hash(arg.constData(), arg.size() + 1, ret);
+    }
+    return ret;
+}
+
+uint32_t ArgumentsTable::insert(const List<ByteArray> &args)
+{
+    if (args.isEmpty())
+        return 0;
+    typedef std::unordered_multimap<uint64_t, uint32_t>::const_iterator Iterator;
+    const uint64_t h = hash(args);
+    {
+        ReadLocker lock(&sLock);
+        const std::pair<Iterator, Iterator> range = sIds.equal_range(h);
+        for (Iterator it = range.first; it != range.second; ++it) {
+            if (*sLists.at(it->second) == args)
+                return it->second;
+        }
+    }
+    WriteLocker lock(&sLock);
+    // someone might have added it while we didn't hold the lock
+    const std::pair<Iterator, Iterator> range = sIds.equal_range(h);
+    for (Iterator it = range.first; it != range.second; ++it) {
+        if (*sLists.at(it->second) == args)
+            return it->second;
+    }
+    const uint32_t id = sLists.size();
+    sLists.append(new List<ByteArray>(args));
+    sIds.insert(std::make_pair(h, id));
+    return id;
+}
+
+const List<ByteArray> &ArgumentsTable::arguments(uint32_t id)
+{
+    ReadLocker lock(&sLock);
+    assert(id < static_cast<uint32_t>(sLists.size()));
+    return *sLists.at(id);
+}
+
+int ArgumentsTable::count()
+{
+    ReadLocker lock(&sLock);
+    return sLists.size() - 1;
+}
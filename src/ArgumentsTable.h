@@ -0,0 +1,28 @@
+#ifndef ArgumentsTable_h
+#define ArgumentsTable_h
+
+#include "ByteArray.h"
+#include "List.h"
+#include "ReadWriteLock.h"
+#include <unordered_map>
+
+// Process-wide table of interned compile argument lists. Most translation
+// units of a project are built with the same flags so each distinct list
+// is stored once and SourceInformation refers to it by id. Lists are
+// immutable and never freed, ids stay valid for the lifetime of the
+// process. Id 0 is the empty list.
+class ArgumentsTable
+{
+public:
+    static uint32_t insert(const List<ByteArray> &args);
+    static const List<ByteArray> &arguments(uint32_t id);
+    static int count();
+private:
+    static uint64_t hash(const List<ByteArray> &args);
+
+    static ReadWriteLock sLock;
+    static std::unordered_multimap<uint64_t, uint32_t> sIds;
+    static List<const List<ByteArray>*> sLists;
+};
+
+#endif
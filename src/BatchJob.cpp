@@ -0,0 +1,48 @@
+#include "BatchJob.h"
+#include "Project.h"
+#include "GRTags.h"
+#include "Indexer.h"
+
+BatchJob::BatchJob(const QueryMessage &query, const std::shared_ptr<Project> &project)
+    : Job(query, 0, project)
+{
+}
+
+void BatchJob::addJob(const std::shared_ptr<Job> &job)
+{
+    mJobs.append(job);
+}
+
+void BatchJob::abort()
+{
+    Job::abort();
+    for (int i=0; i<mJobs.size(); ++i)
+        mJobs.at(i)->abort();
+}
+
+void BatchJob::execute()
+{
+    std::shared_ptr<Project> proj = project();
+    // same order as Indexer::write takes them
+    Scope<const SymbolMap&> symbols;
+    Scope<const SymbolNameMap&> symbolNames;
+    if (proj->indexer) {
+        symbols = proj->lockSymbolsForRead();
+        symbolNames = proj->lockSymbolNamesForRead();
+    }
+    Scope<const GRMap&> gr;
+    if (proj->grtags)
+        gr = proj->lockGRForRead();
+
+    const int count = mJobs.size();
+    for (int i=0; i<count; ++i) {
+        if (isAborted())
+            return;
+        const std::shared_ptr<Job> &job = mJobs.at(i);
+        postOutput(LocationsMessage(i).encode(), LocationsMessage::MessageId);
+        job->setId(id());
+        job->setBatchIndex(i);
+        job->execute();
+        job->flush();
+    }
+}
@@ -0,0 +1,23 @@
+#ifndef BatchJob_h
+#define BatchJob_h
+
+#include "Job.h"
+#include "List.h"
+
+// Runs the jobs of a QueryMessage::Batch one after the other while holding
+// the project's symbol maps for reading, so they all see the same
+// snapshot. Each job's output is preceded by an empty LocationsMessage
+// carrying its index.
+class BatchJob : public Job
+{
+public:
+    BatchJob(const QueryMessage &query, const std::shared_ptr<Project> &project);
+    void addJob(const std::shared_ptr<Job> &job);
+    virtual void abort();
+protected:
+    virtual void execute();
+private:
+    List<std::shared_ptr<Job> > mJobs;
+};
+
+#endif
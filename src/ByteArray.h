@@ -28,6 +28,10 @@ public:
     : mString(ba.mString)
     {}
 
+    ByteArray(ByteArray &&ba)
+        : mString(std::move(ba.mString))
+    {}
+
     ByteArray(const std::string &str)
         : mString(str)
     {}
@@ -38,6 +42,12 @@ public:
         return *this;
     }
 
+    ByteArray &operator=(ByteArray &&other)
+    {
+        mString = std::move(other.mString);
+        return *this;
+    }
+
     int lastIndexOf(char ch, int from = -1) const
     {
         return mString.rfind(ch, from == -1 ? std::string::npos : size_t(from));
@@ -1,14 +1,19 @@
 #include "Client.h"
 #include "Messages.h"
 #include "Connection.h"
+#include "LocationsMessage.h"
 #include "MakefileParser.h"
 #include "ResponseMessage.h"
+#include "SharedMemory.h"
+#include "SharedMemoryMessage.h"
 #include "EventLoop.h"
 #include "Log.h"
+#include <string.h>
 #include <unistd.h>
+#include <sys/mman.h>
 
 Client::Client(const Path &path, unsigned flags, const List<ByteArray> &rdmArgs)
-    : mConnection(0), mFlags(flags), mRdmArgs(rdmArgs), mName(path)
+    : mConnection(0), mPersistent(false), mFlags(flags), mRdmArgs(rdmArgs), mName(path)
 {
     if ((mFlags & (RestartRdm|AutostartRdm)) == (RestartRdm|AutostartRdm)) {
         mFlags &= ~AutostartRdm; // this is implied and would upset connectToServer
@@ -42,12 +47,101 @@ void Client::sendMessage(int id, const ByteArray &msg)
     EventLoop::instance()->run();
 }
 
-void Client::onNewMessage(Message *message, Connection *)
+bool Client::sendRequest(int requestId, int id, const ByteArray &msg)
 {
+    if (!mConnection && !connectToServer()) {
+        if (!(mFlags & DontWarnOnConnectionFailure))
+            fprintf(stderr, "Can't seem to connect to server\n");
+        return false;
+    }
+    if (!mPersistent) {
+        mConnection->disconnected().connect(this, &Client::onDisconnected);
+        mConnection->newMessage().connect(this, &Client::onNewMessage);
+        mPersistent = true;
+    }
+    mConnection->setRequestId(requestId);
+    const bool ret = mConnection->send(id, msg);
+    mConnection->setRequestId(0);
+    if (ret)
+        ++mRequests[requestId];
+    return ret;
+}
+
+void Client::write(int requestId, const char *data, int size)
+{
+    if (!requestId) {
+        fwrite(data, 1, size, stdout);
+        fputc('\n', stdout);
+        return;
+    }
+    const char *end = data + size;
+    while (true) {
+        const char *eol = static_cast<const char*>(memchr(data, '\n', end - data));
+        printf("%d:", requestId);
+        fwrite(data, 1, (eol ? eol : end) - data, stdout);
+        fputc('\n', stdout);
+        if (!eol)
+            break;
+        data = eol + 1;
+    }
+}
+
+void Client::onNewMessage(Message *message, Connection *connection)
+{
+    const int requestId = message->requestId();
     if (message->messageId() == ResponseMessage::MessageId) {
         const ByteArray response = static_cast<ResponseMessage*>(message)->data();
         if (!response.isEmpty()) {
-            printf("%s\n", response.constData());
+            write(requestId, response.constData(), response.size());
+        }
+    } else if (message->messageId() == LocationsMessage::MessageId) {
+        const LocationsMessage *locations = static_cast<LocationsMessage*>(message);
+        if (locations->isEmpty()) {
+            // start of the results of query n in a batch
+            if (locations->index() != -1) {
+                const ByteArray header = ByteArray::snprintf<32>("--- %d", locations->index());
+                write(requestId, header.constData(), header.size());
+            }
+            return;
+        }
+        // the file ids are rdm's, format the keys with our own
+        Map<uint32_t, uint32_t> fileIds;
+        const Map<uint32_t, Path> &paths = locations->paths();
+        for (Map<uint32_t, Path>::const_iterator it = paths.begin(); it != paths.end(); ++it)
+            fileIds[it->first] = Location::insertFile(it->second);
+        const List<LocationsMessage::Entry> &entries = locations->entries();
+        const int count = entries.size();
+        for (int i=0; i<count; ++i) {
+            const Location loc(fileIds.value(entries.at(i).fileId), entries.at(i).offset);
+            const ByteArray key = loc.key(locations->keyFlags());
+            write(requestId, key.constData(), key.size());
+        }
+    } else if (message->messageId() == SharedMemoryMessage::MessageId) {
+        const SharedMemoryMessage *shared = static_cast<SharedMemoryMessage*>(message);
+        {
+            SharedMemory memory(SharedMemory::Id, shared->id());
+            const char *data = static_cast<const char*>(memory.attach(SharedMemory::Read));
+            // nothing is left behind if either of us goes away from here on
+            memory.remove();
+            if (data) {
+#ifdef MADV_POPULATE_READ
+                // one call instead of a page fault per page
+                madvise(const_cast<char*>(data), shared->size(), MADV_POPULATE_READ);
+#endif
+                write(requestId, data, shared->size());
+            } else {
+                error("Can't attach shared memory segment %d", shared->id());
+            }
+        }
+        // rdm reuses or releases the segment when it gets it back
+        connection->send(shared);
+    } else if (message->messageId() == FinishMessage::MessageId) {
+        Map<int, int>::iterator it = mRequests.find(requestId);
+        if (it != mRequests.end() && !--it->second) {
+            mRequests.erase(it);
+            printf("%d.\n", requestId);
+            fflush(stdout);
+            mRequestFinished(requestId);
         }
     } else {
         error("Unexpected message: %d", message->messageId());
@@ -57,6 +151,12 @@ void Client::onNewMessage(Message *message, Connection *)
 
 void Client::onDisconnected()
 {
+    // don't leave rc --server's client waiting for requests rdm won't answer
+    for (Map<int, int>::const_iterator it = mRequests.begin(); it != mRequests.end(); ++it)
+        printf("%d.\n", it->first);
+    fflush(stdout);
+    mRequests.clear();
+    mPersistent = false;
     mConnection->deleteLater();
     mConnection = 0;
     EventLoop::instance()->exit();
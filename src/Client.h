@@ -7,6 +7,7 @@
 #include "ByteArray.h"
 #include "Map.h"
 #include "List.h"
+#include "SignalSlot.h"
 
 class Connection;
 class Message;
@@ -26,12 +27,25 @@ public:
     unsigned flags() const { return mFlags; }
     template<typename T>
     void message(const T *msg);
+    // For rc --server. The connection stays open and the message goes out
+    // tagged with requestId, each line of the response is printed as
+    // "<requestId>:<line>" and "<requestId>." follows once rdm is done.
+    template<typename T>
+    bool request(int requestId, const T *msg);
+    int pendingRequests() const { return mRequests.size(); }
+    signalslot::Signal1<int> &requestFinished() { return mRequestFinished; }
     bool connectToServer();
     void onDisconnected();
     void onNewMessage(Message *message, Connection *);
 private:
     void sendMessage(int id, const ByteArray& msg);
+    bool sendRequest(int requestId, int id, const ByteArray &msg);
+    void write(int requestId, const char *data, int size);
     Connection *mConnection;
+    bool mPersistent;
+    // messages sent for each request that rdm hasn't finished yet
+    Map<int, int> mRequests;
+    signalslot::Signal1<int> mRequestFinished;
     unsigned mFlags;
     List<ByteArray> mRdmArgs;
     const Path mName;
@@ -43,4 +57,10 @@ void Client::message(const T *msg)
     sendMessage(msg->messageId(), msg->encode());
 }
 
+template<typename T>
+bool Client::request(int requestId, const T *msg)
+{
+    return sendRequest(requestId, msg->messageId(), msg->encode());
+}
+
 #endif
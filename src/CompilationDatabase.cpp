@@ -0,0 +1,236 @@
+#include "CompilationDatabase.h"
+#include "EventLoop.h"
+#include "Log.h"
+#include "Server.h"
+#include <string.h>
+
+bool CompilationDatabase::isCompilationDatabase(const Path &path)
+{
+    return !strcmp(path.fileName(), "compile_commands.json");
+}
+
+bool CompilationDatabase::load(const Path &path, List<Command> &commands)
+{
+    char *buf;
+    const int size = path.readAll(buf);
+    if (size < 0) {
+        error() << "Can't read" << path;
+        return false;
+    }
+    const bool ret = parse(buf, size, commands);
+    delete[] buf;
+    if (!ret)
+        error() << "Can't parse" << path;
+    return ret;
+}
+
+class JsonReader
+{
+public:
+    JsonReader(const char *json, int length)
+        : mPos(json), mEnd(json + length)
+    {}
+
+    bool atEnd() { skipSpace(); return mPos == mEnd; }
+
+    bool accept(char ch)
+    {
+        skipSpace();
+        if (mPos < mEnd && *mPos == ch) {
+            ++mPos;
+            return true;
+        }
+        return false;
+    }
+
+    bool readString(ByteArray &out)
+    {
+        out.clear();
+        if (!accept('"'))
+            return false;
+        const char *start = mPos;
+        while (mPos < mEnd) {
+            switch (*mPos) {
+            case '"':
+                out.append(start, mPos - start);
+                ++mPos;
+                return true;
+            case '\\': {
+                out.append(start, mPos - start);
+                if (++mPos == mEnd)
+                    return false;
+                switch (*mPos++) {
+                case 'b': out.append('\b'); break;
+                case 'f': out.append('\f'); break;
+                case 'n': out.append('\n'); break;
+                case 'r': out.append('\r'); break;
+                case 't': out.append('\t'); break;
+                case 'u': {
+                    if (mEnd - mPos < 4)
+                        return false;
+                    const unsigned code = strtoul(ByteArray(mPos, 4).constData(), 0, 16);
+                    mPos += 4;
+                    // surrogate pairs come out as two sequences, that's fine for paths and flags
+                    if (code < 0x80) {
+                        out.append(static_cast<char>(code));
+                    } else if (code < 0x800) {
+                        out.append(static_cast<char>(0xc0 | (code >> 6)));
+                        out.append(static_cast<char>(0x80 | (code & 0x3f)));
+                    } else {
+                        out.append(static_cast<char>(0xe0 | (code >> 12)));
+                        out.append(static_cast<char>(0x80 | ((code >> 6) & 0x3f)));
+                        out.append(static_cast<char>(0x80 | (code & 0x3f)));
+                    }
+                    break; }
+                default: out.append(*(mPos - 1)); break;
+                }
+                start = mPos;
+                break; }
+            default:
+                ++mPos;
+                break;
+            }
+        }
+        return false;
+    }
+
+    bool skipValue()
+    {
+        skipSpace();
+        if (mPos == mEnd)
+            return false;
+        switch (*mPos) {
+        case '"': {
+            ByteArray dummy;
+            return readString(dummy); }
+        case '[':
+            ++mPos;
+            if (accept(']'))
+                return true;
+            do {
+                if (!skipValue())
+                    return false;
+            } while (accept(','));
+            return accept(']');
+        case '{':
+            ++mPos;
+            if (accept('}'))
+                return true;
+            do {
+                ByteArray key;
+                if (!readString(key) || !accept(':') || !skipValue())
+                    return false;
+            } while (accept(','));
+            return accept('}');
+        default:
+            // numbers, true, false and null
+            while (mPos < mEnd && !strchr(",]} \t\r\n", *mPos))
+                ++mPos;
+            return true;
+        }
+    }
+private:
+    void skipSpace()
+    {
+        while (mPos < mEnd && (*mPos == ' ' || *mPos == '\t' || *mPos == '\r' || *mPos == '\n'))
+            ++mPos;
+    }
+
+    const char *mPos, *mEnd;
+};
+
+// GccArguments::parse splits on unquoted spaces and drops quotes and
+// backslashes, so escape those in each argument
+static inline void appendArgument(ByteArray &command, const ByteArray &arg)
+{
+    if (!command.isEmpty())
+        command.append(' ');
+    const int size = arg.size();
+    for (int i=0; i<size; ++i) {
+        const char ch = arg.at(i);
+        switch (ch) {
+        case ' ':
+        case '"':
+        case '\'':
+        case '\\':
+            command.append('\\');
+            break;
+        default:
+            break;
+        }
+        command.append(ch);
+    }
+}
+
+bool CompilationDatabase::parse(const char *json, int length, List<Command> &commands)
+{
+    JsonReader reader(json, length);
+    if (!reader.accept('['))
+        return false;
+    if (reader.accept(']'))
+        return reader.atEnd();
+    do {
+        if (!reader.accept('{'))
+            return false;
+        Command command;
+        if (!reader.accept('}')) {
+            do {
+                ByteArray key, value;
+                if (!reader.readString(key) || !reader.accept(':'))
+                    return false;
+                if (key == "directory") {
+                    if (!reader.readString(value))
+                        return false;
+                    command.directory = value;
+                } else if (key == "command") {
+                    if (!reader.readString(command.command))
+                        return false;
+                } else if (key == "arguments") {
+                    if (!reader.accept('['))
+                        return false;
+                    command.command.clear();
+                    if (!reader.accept(']')) {
+                        do {
+                            if (!reader.readString(value))
+                                return false;
+                            appendArgument(command.command, value);
+                        } while (reader.accept(','));
+                        if (!reader.accept(']'))
+                            return false;
+                    }
+                } else if (!reader.skipValue()) {
+                    return false;
+                }
+            } while (reader.accept(','));
+            if (!reader.accept('}'))
+                return false;
+        }
+        if (!command.command.isEmpty()) {
+            if (!command.directory.endsWith('/'))
+                command.directory.append('/');
+            commands.append(command);
+        }
+    } while (reader.accept(','));
+    return reader.accept(']') && reader.atEnd();
+}
+
+CompilationDatabaseJob::CompilationDatabaseJob(const Path &path, const List<CompilationDatabase::Command> &commands,
+                                               const List<ByteArray> &extraCompilerFlags)
+    : mPath(path), mCommands(commands), mExtraCompilerFlags(extraCompilerFlags)
+{
+}
+
+void CompilationDatabaseJob::run()
+{
+    List<GccArguments> ret;
+    const int count = mCommands.size();
+    for (int i=0; i<count; ++i) {
+        const CompilationDatabase::Command &command = mCommands.at(i);
+        GccArguments args;
+        if (args.parse(command.command, command.directory)) {
+            args.addFlags(mExtraCompilerFlags);
+            ret.append(args);
+        }
+    }
+    EventLoop::instance()->postEvent(Server::instance(), new CompilationDatabaseEvent(mPath, ret));
+}
@@ -0,0 +1,53 @@
+#ifndef CompilationDatabase_h
+#define CompilationDatabase_h
+
+#include "ByteArray.h"
+#include "Event.h"
+#include "GccArguments.h"
+#include "List.h"
+#include "Path.h"
+#include "ThreadPool.h"
+
+// Reads the compile_commands.json files written by CMake, Ninja and Bear.
+// The file is scanned in a single pass, one command object at a time,
+// without building a document tree.
+class CompilationDatabase
+{
+public:
+    struct Command {
+        Path directory;
+        ByteArray command;
+    };
+
+    static bool isCompilationDatabase(const Path &path);
+    static bool load(const Path &path, List<Command> &commands);
+    static bool parse(const char *json, int length, List<Command> &commands);
+};
+
+// Turns a slice of the commands into GccArguments on the thread pool and
+// posts them back to the Server as a CompilationDatabaseEvent.
+class CompilationDatabaseJob : public ThreadPool::Job
+{
+public:
+    CompilationDatabaseJob(const Path &path, const List<CompilationDatabase::Command> &commands,
+                           const List<ByteArray> &extraCompilerFlags);
+protected:
+    virtual void run();
+private:
+    const Path mPath;
+    const List<CompilationDatabase::Command> mCommands;
+    const List<ByteArray> mExtraCompilerFlags;
+};
+
+class CompilationDatabaseEvent : public Event
+{
+public:
+    enum { Type = 5 };
+    CompilationDatabaseEvent(const Path &p, const List<GccArguments> &a)
+        : Event(Type), path(p), args(a)
+    {}
+    const Path path;
+    const List<GccArguments> args;
+};
+
+#endif
@@ -0,0 +1,217 @@
+#include "CompletionJob.h"
+#include "Log.h"
+#include "Mutex.h"
+#include "MutexLocker.h"
+#include "RTags.h"
+#include "Server.h"
+#include "Timer.h"
+#include <clang-c/Index.h>
+
+struct CompletionUnit
+{
+    CompletionUnit()
+        : index(0), unit(0), lastUse(0)
+    {}
+    ~CompletionUnit()
+    {
+        if (unit)
+            clang_disposeTranslationUnit(unit);
+        if (index)
+            clang_disposeIndex(index);
+    }
+
+    Mutex mutex;
+    CXIndex index;
+    CXTranslationUnit unit;
+    uint32_t argsId;
+    int lastUse;
+};
+
+static Mutex sMutex;
+static Map<Path, std::shared_ptr<CompletionUnit> > sUnits; // keyed on source file
+static Map<Path, int> sRequests; // latest request per file
+
+CompletionJob::CompletionJob(const Location &loc, const QueryMessage &query, const std::shared_ptr<Project> &proj,
+                             const SourceInformation &src, const UnsavedFilesMap &unsaved)
+    : Job(query, WriteUnfiltered|WriteBuffered, proj), location(loc), source(src), unsavedFiles(unsaved),
+      maxResults(query.max())
+{
+    MutexLocker lock(&sMutex);
+    request = ++sRequests[location.path()];
+}
+
+void CompletionJob::clearCache()
+{
+    MutexLocker lock(&sMutex);
+    sUnits.clear();
+    sRequests.clear();
+}
+
+bool CompletionJob::isCurrent() const
+{
+    MutexLocker lock(&sMutex);
+    return sRequests.value(location.path()) == request;
+}
+
+static inline bool lineAndColumn(const Path &path, uint32_t offset, const UnsavedFilesMap &unsavedFiles,
+                                 unsigned *line, unsigned *column)
+{
+    const char *contents = 0;
+    char *buf = 0;
+    const UnsavedFilesMap::const_iterator it = unsavedFiles.find(path);
+    if (it != unsavedFiles.end()) {
+        if (offset > static_cast<uint32_t>(it->second.size()))
+            return false;
+        contents = it->second.constData();
+    } else if (offset) {
+        if (path.readAll(buf, offset) != static_cast<int>(offset))
+            return false;
+        contents = buf;
+    }
+    *line = 1;
+    *column = 1;
+    for (uint32_t i=0; i<offset; ++i) {
+        if (contents[i] == '\n') {
+            ++*line;
+            *column = 1;
+        } else {
+            ++*column;
+        }
+    }
+    delete[] buf;
+    return true;
+}
+
+static inline bool compareCompletionPriority(const std::pair<unsigned, unsigned> &l, const std::pair<unsigned, unsigned> &r)
+{
+    return l.first < r.first;
+}
+
+void CompletionJob::execute()
+{
+    Timer timer;
+    const Path path = location.path();
+    unsigned line, column;
+    if (!lineAndColumn(path, location.offset(), unsavedFiles, &line, &column)) {
+        error("Can't find line/column for %s,%d", path.constData(), location.offset());
+        return;
+    }
+
+    std::shared_ptr<CompletionUnit> cached;
+    {
+        MutexLocker lock(&sMutex);
+        std::shared_ptr<CompletionUnit> &ref = sUnits[source.sourceFile];
+        if (!ref || ref->argsId != source.argsId) {
+            ref.reset(new CompletionUnit);
+            ref->argsId = source.argsId;
+        }
+        ref->lastUse = Timer::current();
+        cached = ref;
+        if (sUnits.size() > MaxCachedUnits) {
+            Map<Path, std::shared_ptr<CompletionUnit> >::iterator oldest = sUnits.end();
+            for (Map<Path, std::shared_ptr<CompletionUnit> >::iterator it = sUnits.begin(); it != sUnits.end(); ++it) {
+                if (it->second != cached && (oldest == sUnits.end() || it->second->lastUse < oldest->second->lastUse))
+                    oldest = it;
+            }
+            if (oldest != sUnits.end())
+                sUnits.erase(oldest); // a job still using it keeps it alive
+        }
+    }
+
+    // only one job can use a translation unit at a time
+    MutexLocker lock(&cached->mutex);
+    if (!isCurrent())
+        return;
+
+    List<CXUnsavedFile> unsaved(unsavedFiles.size());
+    int unsavedCount = 0;
+    for (UnsavedFilesMap::const_iterator it = unsavedFiles.begin(); it != unsavedFiles.end(); ++it) {
+        CXUnsavedFile &file = unsaved[unsavedCount++];
+        file.Filename = it->first.constData();
+        file.Contents = it->second.constData();
+        file.Length = it->second.size();
+    }
+
+    if (!cached->unit) {
+        cached->index = clang_createIndex(0, 0);
+        const List<ByteArray> &args = source.args();
+        List<const char*> clangArgs(args.size() + 1, 0);
+        int idx = 0;
+#ifdef OS_Darwin
+        clangArgs[idx++] = "-I/usr/lib/c++/v1";
+#endif
+        const int count = args.size();
+        for (int i=0; i<count; ++i) {
+            if (!args.at(i).isEmpty())
+                clangArgs[idx++] = args.at(i).constData();
+        }
+        cached->unit = clang_parseTranslationUnit(cached->index, source.sourceFile.constData(),
+                                                  clangArgs.data(), idx, unsaved.data(), unsavedCount,
+                                                  CXTranslationUnit_PrecompiledPreamble
+                                                  | CXTranslationUnit_CacheCompletionResults
+                                                  | CXTranslationUnit_Incomplete);
+        // the preamble is built on the first reparse
+        if (cached->unit && clang_reparseTranslationUnit(cached->unit, unsavedCount, unsaved.data(),
+                                                         clang_defaultReparseOptions(cached->unit))) {
+            clang_disposeTranslationUnit(cached->unit);
+            cached->unit = 0;
+        }
+        if (!cached->unit) {
+            error() << "Failed to parse" << source.sourceFile << "for completion";
+            return;
+        }
+        warning() << "Created completion unit for" << source.sourceFile << "in" << timer.elapsed() << "ms";
+    }
+
+    CXCodeCompleteResults *results = clang_codeCompleteAt(cached->unit, path.constData(), line, column,
+                                                          unsaved.data(), unsavedCount,
+                                                          clang_defaultCodeCompleteOptions());
+    if (!results)
+        return;
+
+    // best matches first so they make it out within the budget
+    List<std::pair<unsigned, unsigned> > sorted(results->NumResults);
+    for (unsigned i=0; i<results->NumResults; ++i) {
+        sorted[i].first = clang_getCompletionPriority(results->Results[i].CompletionString);
+        sorted[i].second = i;
+    }
+    std::stable_sort(sorted.begin(), sorted.end(), compareCompletionPriority);
+
+    // parsing can take as long as it needs, the budget is for formatting
+    // the results so the first batch always makes it out
+    timer.restart();
+    int max = maxResults;
+    for (unsigned i=0; i<results->NumResults && max; ++i) {
+        if (!(i % 64) && (timer.elapsed() > LatencyBudget || !isCurrent()))
+            break;
+        const CXCompletionString string = results->Results[sorted.at(i).second].CompletionString;
+        if (clang_getCompletionAvailability(string) == CXAvailability_NotAvailable)
+            continue;
+        ByteArray typedText, signature;
+        const unsigned chunkCount = clang_getNumCompletionChunks(string);
+        for (unsigned c=0; c<chunkCount; ++c) {
+            const CXCompletionChunkKind kind = clang_getCompletionChunkKind(string, c);
+            if (kind == CXCompletionChunk_Optional || kind == CXCompletionChunk_Informative)
+                continue;
+            const ByteArray text = RTags::eatString(clang_getCompletionChunkText(string, c));
+            switch (kind) {
+            case CXCompletionChunk_TypedText:
+                typedText = text;
+                signature += text;
+                break;
+            case CXCompletionChunk_ResultType:
+                signature.prepend(text + ' ');
+                break;
+            default:
+                signature += text;
+                break;
+            }
+        }
+        if (typedText.isEmpty())
+            continue;
+        write(typedText + ' ' + signature);
+        if (max > 0)
+            --max;
+    }
+    clang_disposeCodeCompleteResults(results);
+}
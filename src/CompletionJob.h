@@ -0,0 +1,32 @@
+#ifndef CompletionJob_h
+#define CompletionJob_h
+
+#include "ByteArray.h"
+#include "Job.h"
+#include "Location.h"
+#include "QueryMessage.h"
+#include "SourceInformation.h"
+
+class CompletionJob : public Job
+{
+public:
+    enum {
+        LatencyBudget = 1000, // ms of writing results, the rest are dropped
+        MaxCachedUnits = 8
+    };
+    CompletionJob(const Location &loc, const QueryMessage &query, const std::shared_ptr<Project> &proj,
+                  const SourceInformation &source, const UnsavedFilesMap &unsavedFiles);
+    static void clearCache();
+protected:
+    virtual void execute();
+private:
+    bool isCurrent() const;
+
+    const Location location;
+    const SourceInformation source;
+    const UnsavedFilesMap unsavedFiles;
+    const int maxResults;
+    int request;
+};
+
+#endif
@@ -8,26 +8,26 @@ class ResponseMessageEvent : public Event
 public:
     enum { Type = 1 };
     ResponseMessageEvent(const ByteArray &r)
-        : Event(Type), response(r)
+        : Event(Type), response(new ByteArray(r))
     {}
 
-    const ByteArray response;
+    const LocalClient::Buffer response;
 };
 
 Connection::Connection()
-    : mClient(new LocalClient), mPendingRead(0), mPendingWrite(0), mDone(false), mSilent(false)
+    : mClient(new LocalClient), mPendingRead(0), mPendingWrite(0), mRequestId(0), mDone(false), mSilent(false)
 {
     mClient->connected().connect(mConnected);
-    mClient->disconnected().connect(mDisconnected);
+    mClient->disconnected().connect(this, &Connection::onClientDisconnected);
     mClient->dataAvailable().connect(this, &Connection::dataAvailable);
     mClient->bytesWritten().connect(this, &Connection::dataWritten);
 }
 
 Connection::Connection(LocalClient* client)
-    : mClient(client), mPendingRead(0), mPendingWrite(0), mDone(false), mSilent(false)
+    : mClient(client), mPendingRead(0), mPendingWrite(0), mRequestId(0), mDone(false), mSilent(false)
 {
     assert(client->isConnected());
-    mClient->disconnected().connect(mDisconnected);
+    mClient->disconnected().connect(this, &Connection::onClientDisconnected);
     mClient->dataAvailable().connect(this, &Connection::dataAvailable);
     mClient->bytesWritten().connect(this, &Connection::dataWritten);
 }
@@ -45,6 +45,11 @@ bool Connection::connectToServer(const ByteArray &name)
 }
 
 bool Connection::send(int id, const ByteArray &message)
+{
+    return send(id, LocalClient::Buffer(new ByteArray(message)));
+}
+
+bool Connection::send(int id, const LocalClient::Buffer &message)
 {
     if (!mClient->isConnected()) {
         ::error("Trying to send message to unconnected client (%d)", id);
@@ -54,20 +59,17 @@ bool Connection::send(int id, const ByteArray &message)
     if (mSilent)
         return true;
 
-    ByteArray header, data;
+    // the message goes out as is, behind a separate size, id and request id header
+    LocalClient::Buffer header(new ByteArray);
     {
-        {
-            Serializer strm(data);
-            strm << id;
-            strm.write(message.constData(), message.size());
-        }
-        {
-            Serializer strm(header);
-            strm << data.size();
-        }
+        Serializer strm(*header);
+        strm << static_cast<int>(sizeof(id) + sizeof(mRequestId) + message->size()) << id << mRequestId;
     }
-    mPendingWrite += (header.size() + data.size());
-    return mClient->write(header) && mClient->write(data);
+    mPendingWrite += (header->size() + message->size());
+    List<LocalClient::Buffer> buffers(2);
+    buffers[0] = header;
+    buffers[1] = message;
+    return mClient->write(buffers);
 }
 
 int Connection::pendingWrite() const
@@ -76,6 +78,15 @@ int Connection::pendingWrite() const
 }
 void Connection::finish()
 {
+    if (mRequestId) {
+        // the client is waiting for this even if the request was silent
+        const bool silent = mSilent;
+        mSilent = false;
+        const FinishMessage msg;
+        send(&msg);
+        mSilent = silent;
+        return;
+    }
     mDone = true;
     dataWritten(0);
 }
@@ -88,38 +99,36 @@ void Connection::dataAvailable()
         if (!mPendingRead) {
             if (available < static_cast<int>(sizeof(uint32_t)))
                 break;
-            char buf[sizeof(uint32_t)];
-            const int read = mClient->read(buf, 4);
-            assert(read == 4);
-            Deserializer strm(buf, read);
+            Deserializer strm(mClient->peek(), sizeof(uint32_t));
             strm >> mPendingRead;
-            available -= 4;
+            mClient->skip(sizeof(uint32_t));
+            available -= sizeof(uint32_t);
         }
         if (available < mPendingRead)
             break;
-        char buf[1024];
-        char *buffer = buf;
-        if (mPendingRead > static_cast<int>(sizeof(buf))) {
-            buffer = new char[mPendingRead];
-        }
-        const int read = mClient->read(buffer, mPendingRead);
-        assert(read == mPendingRead);
-        Message *message = Messages::create(buffer, read);
+        // decoded straight out of the client's read buffer
+        Message *message = Messages::create(mClient->peek(), mPendingRead);
+        mClient->skip(mPendingRead);
+        mPendingRead = 0;
         if (message) {
             newMessage()(message, this);
             delete message;
         }
-        if (buffer != buf)
-            delete[] buffer;
-
-        mPendingRead = 0;
     }
 }
 
+void Connection::onClientDisconnected()
+{
+    mDisconnected();
+    mClosed(this);
+}
+
 void Connection::dataWritten(int bytes)
 {
     assert(mPendingWrite >= bytes);
     mPendingWrite -= bytes;
+    if (bytes)
+        mBytesWritten(this, bytes);
     if (!mPendingWrite) {
         if (bytes)
             sendComplete()();
@@ -139,8 +148,7 @@ void Connection::event(const Event *e)
 {
     switch (e->type()) {
     case ResponseMessageEvent::Type: {
-        ResponseMessage msg(static_cast<const ResponseMessageEvent*>(e)->response);
-        send(&msg);
+        send(ResponseMessage::MessageId, static_cast<const ResponseMessageEvent*>(e)->response);
         break; }
     default:
         EventReceiver::event(e);
@@ -21,12 +21,18 @@ public:
     void setSilent(bool on) { mSilent = on; }
     bool isSilent() const { return mSilent; }
 
+    // The request everything sent goes out tagged with. While it's set
+    // finish() ends that request and leaves the connection open.
+    void setRequestId(int id) { mRequestId = id; }
+    int requestId() const { return mRequestId; }
+
     bool connectToServer(const ByteArray &name);
 
     int pendingWrite() const;
 
     template<typename T> bool send(const T *message);
     bool send(int id, const ByteArray& message);
+    bool send(int id, const LocalClient::Buffer &message);
     template <int StaticBufSize>
     bool write(const char *format, ...)
     {
@@ -39,8 +45,7 @@ public:
     }
     bool write(const ByteArray &out)
     {
-        ResponseMessage msg(out);
-        return send(&msg);
+        return send(ResponseMessage::MessageId, LocalClient::Buffer(new ByteArray(out)));
     }
 
     void writeAsync(const ByteArray &out);
@@ -54,25 +59,30 @@ public:
     signalslot::Signal2<Message*, Connection*> &newMessage() { return mNewMessage; }
     signalslot::Signal0 &sendComplete() { return mSendComplete; }
     signalslot::Signal1<Connection*> &destroyed() { return mDestroyed; }
+    // same as disconnected but with the connection, for listeners that watch several
+    signalslot::Signal1<Connection*> &closed() { return mClosed; }
+    signalslot::Signal2<Connection*, int> &bytesWritten() { return mBytesWritten; }
 protected:
     void event(const Event *e);
 private:
     void dataAvailable();
     void dataWritten(int bytes);
+    void onClientDisconnected();
 
     LocalClient *mClient;
-    int mPendingRead, mPendingWrite;
+    int mPendingRead, mPendingWrite, mRequestId;
     bool mDone, mSilent;
 
     signalslot::Signal0 mConnected, mDisconnected, mError, mSendComplete;
     signalslot::Signal2<Message*, Connection*> mNewMessage;
-    signalslot::Signal1<Connection*> mDestroyed;
+    signalslot::Signal1<Connection*> mDestroyed, mClosed;
+    signalslot::Signal2<Connection*, int> mBytesWritten;
 };
 
 template<typename T>
 bool Connection::send(const T *message)
 {
-    return send(message->messageId(), message->encode());
+    return send(message->messageId(), LocalClient::Buffer(new ByteArray(message->encode())));
 }
 
 #endif // CONNECTION_H
@@ -5,11 +5,20 @@
 #include "RTags.h"
 #include "ThreadLocal.h"
 #include "config.h"
+#include "Log.h"
 #include <algorithm>
 #include <errno.h>
 #include <fcntl.h>
+#ifdef HAVE_EVENTFD
+#include <sys/eventfd.h>
+#endif
+#ifdef HAVE_EPOLL
+#include <sys/epoll.h>
+#else
 #include <sys/select.h>
+#endif
 #include <sys/ioctl.h>
+#include <sched.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -72,7 +81,7 @@ static inline int timevalDiff(timeval* a, timeval* b)
     return ams - bms;
 }
 
-static inline bool gettime(timeval* time)
+bool EventLoop::gettime(timeval* time)
 {
 #if defined(HAVE_MACH_ABSOLUTE_TIME)
     pthread_once(&sEventLoopInit, initTimebaseInfo);
@@ -107,23 +116,51 @@ static inline bool gettime(timeval* time)
 EventLoop* EventLoop::sInstance = 0;
 
 EventLoop::EventLoop()
-    : mQuit(false), mNextTimerHandle(0), mThread(0)
+    : mQuit(false), mNextTimerHandle(0), mQueueHead(&mQueueStub), mQueueTail(&mQueueStub),
+      mSendingTo(0), mWakeupPending(false), mQuitPending(false), mThread(0)
 {
     if (!sInstance)
         sInstance = this;
+    mQueueStub.receiver = 0;
+    mQueueStub.event = 0;
+    mQueueStub.next = 0;
+#ifdef HAVE_EVENTFD
+    mEventPipe[0] = mEventPipe[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    assert(mEventPipe[0] != -1);
+#else
     int flg;
     eintrwrap(flg, ::pipe(mEventPipe));
     eintrwrap(flg, ::fcntl(mEventPipe[0], F_GETFL, 0));
     eintrwrap(flg, ::fcntl(mEventPipe[0], F_SETFL, flg | O_NONBLOCK));
     eintrwrap(flg, ::fcntl(mEventPipe[1], F_GETFL, 0));
     eintrwrap(flg, ::fcntl(mEventPipe[1], F_SETFL, flg | O_NONBLOCK));
+#endif
+#ifdef HAVE_EPOLL
+    mPollFd = epoll_create1(EPOLL_CLOEXEC);
+    assert(mPollFd != -1);
+    epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = mEventPipe[0];
+    epoll_ctl(mPollFd, EPOLL_CTL_ADD, mEventPipe[0], &ev);
+#endif
 }
 
 EventLoop::~EventLoop()
 {
     int err;
     eintrwrap(err, ::close(mEventPipe[0]));
-    eintrwrap(err, ::close(mEventPipe[1]));
+    if (mEventPipe[1] != mEventPipe[0])
+        eintrwrap(err, ::close(mEventPipe[1]));
+#ifdef HAVE_EPOLL
+    eintrwrap(err, ::close(mPollFd));
+#endif
+    // events nobody got around to sending
+    takePostedEvents();
+    for (std::deque<EventData>::const_iterator it = mEvents.begin(); it != mEvents.end(); ++it)
+        delete it->event;
+    for (Map<int, TimerData*>::const_iterator it = mTimerByHandle.begin(); it != mTimerByHandle.end(); ++it)
+        delete it->second;
 }
 
 EventLoop* EventLoop::instance()
@@ -150,10 +187,7 @@ int EventLoop::addTimer(int timeout, TimerFunc callback, void* userData)
     gettime(&data->when);
     timevalAdd(&data->when, timeout);
     mTimerByHandle[handle] = data;
-
-    List<TimerData*>::iterator it = std::lower_bound(mTimerData.begin(), mTimerData.end(),
-                                                     data, timerLessThan);
-    mTimerData.insert(it, data);
+    timerHeapPush(data);
 
     return handle;
 }
@@ -165,15 +199,89 @@ void EventLoop::removeTimer(int handle)
         return;
     TimerData* data = it->second;
     mTimerByHandle.erase(it);
-    List<TimerData*>::iterator dit = std::find(mTimerData.begin(), mTimerData.end(), data);
-    assert(dit != mTimerData.end());
-    assert((*dit)->handle == handle);
-    mTimerData.erase(dit);
+    timerHeapRemove(data);
     delete data;
 }
 
+void EventLoop::timerSiftUp(int idx)
+{
+    TimerData* data = mTimerHeap[idx];
+    while (idx > 0) {
+        const int parent = (idx - 1) / 2;
+        if (!timerLessThan(data, mTimerHeap[parent]))
+            break;
+        mTimerHeap[idx] = mTimerHeap[parent];
+        mTimerHeap[idx]->heapIndex = idx;
+        idx = parent;
+    }
+    mTimerHeap[idx] = data;
+    data->heapIndex = idx;
+}
+
+void EventLoop::timerSiftDown(int idx)
+{
+    TimerData* data = mTimerHeap[idx];
+    const int size = mTimerHeap.size();
+    while (true) {
+        int child = (idx * 2) + 1;
+        if (child >= size)
+            break;
+        if (child + 1 < size && timerLessThan(mTimerHeap[child + 1], mTimerHeap[child]))
+            ++child;
+        if (!timerLessThan(mTimerHeap[child], data))
+            break;
+        mTimerHeap[idx] = mTimerHeap[child];
+        mTimerHeap[idx]->heapIndex = idx;
+        idx = child;
+    }
+    mTimerHeap[idx] = data;
+    data->heapIndex = idx;
+}
+
+void EventLoop::timerHeapPush(TimerData* data)
+{
+    mTimerHeap.append(data);
+    timerSiftUp(mTimerHeap.size() - 1);
+}
+
+void EventLoop::timerHeapRemove(TimerData* data)
+{
+    const int idx = data->heapIndex;
+    assert(idx >= 0 && idx < mTimerHeap.size() && mTimerHeap[idx] == data);
+    TimerData* last = mTimerHeap[mTimerHeap.size() - 1];
+    mTimerHeap.removeLast();
+    data->heapIndex = -1;
+    if (last == data)
+        return;
+    mTimerHeap[idx] = last;
+    last->heapIndex = idx;
+    if (idx > 0 && timerLessThan(last, mTimerHeap[(idx - 1) / 2])) {
+        timerSiftUp(idx);
+    } else {
+        timerSiftDown(idx);
+    }
+}
+
+#ifdef HAVE_EPOLL
+static inline void updateEpoll(int pollFd, int op, int fd, unsigned int flags)
+{
+    epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    if (flags & EventLoop::Read)
+        ev.events |= EPOLLIN;
+    if (flags & EventLoop::Write)
+        ev.events |= EPOLLOUT;
+    ev.data.fd = fd;
+    if (epoll_ctl(pollFd, op, fd, &ev) == -1)
+        error("EventLoop: epoll_ctl failed for %d (%d) %s", fd, errno, strerror(errno));
+}
+#endif
+
 void EventLoop::addFileDescriptor(int fd, unsigned int flags, FdFunc callback, void* userData)
 {
+#ifdef HAVE_EPOLL
+    updateEpoll(mPollFd, mFdData.contains(fd) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, flags);
+#endif
     FdData &data = mFdData[fd];
     data.flags = flags;
     data.callback = callback;
@@ -182,215 +290,333 @@ void EventLoop::addFileDescriptor(int fd, unsigned int flags, FdFunc callback, v
 
 void EventLoop::removeFileDescriptor(int fd, unsigned int flags)
 {
-    if (!flags)
-        mFdData.remove(fd);
-    else {
-        Map<int, FdData>::iterator it = mFdData.find(fd);
-        if (it == mFdData.end())
-            return;
+    Map<int, FdData>::iterator it = mFdData.find(fd);
+    if (it == mFdData.end())
+        return;
+    if (flags)
         it->second.flags &= ~flags;
-        if (!it->second.flags)
-            mFdData.erase(it);
+    if (!flags || !it->second.flags) {
+        mFdData.erase(it);
+#ifdef HAVE_EPOLL
+        // has to happen before the fd is closed, epoll watches the open file
+        // and a forked child may still have it open
+        updateEpoll(mPollFd, EPOLL_CTL_DEL, fd, 0);
+    } else {
+        updateEpoll(mPollFd, EPOLL_CTL_MOD, fd, it->second.flags);
+#endif
     }
 }
 
-void EventLoop::removeEvents(EventReceiver *receiver)
+void EventLoop::push(EventNode* node)
 {
-    MutexLocker locker(&mMutex);
-    std::deque<EventData>::iterator it = mEvents.begin();
-    while (it != mEvents.end()) {
-        if (it->receiver == receiver) {
-            delete it->event;
-            it = mEvents.erase(it);
+    node->next = 0;
+    EventNode* prev = mQueueHead.exchange(node);
+    // the queue is briefly disconnected here, pop() treats that as empty
+    prev->next = node;
+}
+
+// mEventsMutex held
+EventLoop::EventNode* EventLoop::pop()
+{
+    EventNode* tail = mQueueTail;
+    EventNode* next = tail->next;
+    if (tail == &mQueueStub) {
+        if (!next)
+            return 0;
+        mQueueTail = tail = next;
+        next = next->next;
+    }
+    if (next) {
+        mQueueTail = next;
+        return tail;
+    }
+    if (tail != mQueueHead.load())
+        return 0; // a producer is between exchange and link
+    push(&mQueueStub);
+    next = tail->next;
+    if (next) {
+        mQueueTail = next;
+        return tail;
+    }
+    return 0;
+}
+
+// moves everything from the lock-free queue into mEvents, applying
+// removeEvents markers as they come. With a marker, keeps going until that
+// marker has been taken. mEventsMutex held.
+void EventLoop::takePostedEvents(const EventNode* marker)
+{
+    for (;;) {
+        EventNode* node = pop();
+        if (!node) {
+            if (!marker)
+                break;
+            // a producer is between exchange and link, our marker is behind it
+            sched_yield();
+            continue;
+        }
+        if (node->event) {
+            const EventData data = { node->receiver, node->event };
+            mEvents.push_back(data);
         } else {
-            ++it;
+            std::deque<EventData>::iterator it = mEvents.begin();
+            while (it != mEvents.end()) {
+                if (it->receiver == node->receiver) {
+                    delete it->event;
+                    it = mEvents.erase(it);
+                } else {
+                    ++it;
+                }
+            }
         }
+        const bool done = node == marker;
+        delete node;
+        if (done)
+            break;
     }
 }
 
-void EventLoop::postEvent(EventReceiver* receiver, Event* event)
+void EventLoop::wakeup()
 {
-    {
-        EventData data = { receiver, event };
-
-        MutexLocker locker(&mMutex);
-        mEvents.push_back(data);
-    }
+#ifdef HAVE_EVENTFD
+    const uint64_t c = 1;
+#else
     const char c = 'e';
+#endif
     int r;
     do {
-        eintrwrap(r, ::write(mEventPipe[1], &c, 1));
+        eintrwrap(r, ::write(mEventPipe[1], &c, sizeof(c)));
     } while (r == -1 && (errno == EAGAIN || errno == EWOULDBLOCK));
 }
 
+// Synchronous from any thread: when this returns nothing posted to
+// receiver before the call will be sent, and it isn't being sent to.
+void EventLoop::removeEvents(EventReceiver *receiver)
+{
+    EventNode* node = new EventNode;
+    node->receiver = receiver;
+    node->event = 0;
+    MutexLocker lock(&mEventsMutex);
+    push(node);
+    takePostedEvents(node);
+    if (!mThread || pthread_equal(mThread, pthread_self()))
+        return;
+    while (mSendingTo == receiver)
+        mEventsCondition.wait(&mEventsMutex);
+}
+
+void EventLoop::postEvent(EventReceiver* receiver, Event* event)
+{
+    EventNode* node = new EventNode;
+    node->receiver = receiver;
+    node->event = event;
+    push(node);
+    if (!mWakeupPending.exchange(true))
+        wakeup();
+}
+
 void EventLoop::run()
 {
     mQuit = false;
     mThread = pthread_self();
-    fd_set rset, wset;
-    int max;
-    timeval timedata, timenow;
-    for (;;) {
-        FD_ZERO(&rset);
-        FD_ZERO(&wset);
-        FD_SET(mEventPipe[0], &rset);
-        max = mEventPipe[0];
-        for (Map<int, FdData>::const_iterator it = mFdData.begin();
-             it != mFdData.end(); ++it) {
-            if (it->second.flags & Read)
-                FD_SET(it->first, &rset);
-            if (it->second.flags & Write)
-                FD_SET(it->first, &wset);
-            max = std::max(max, it->first);
-        }
-        timeval* timeout;
-        if (mTimerData.empty()) {
-            timeout = 0;
-        } else {
-            gettime(&timenow);
-            timedata = (*mTimerData.begin())->when;
-            timevalSub(&timedata, &timenow);
-            timeout = &timedata;
-        }
-        int r;
-        // ### use poll instead? easier to catch exactly what fd that was problematic in the EBADF case
-        eintrwrap(r, ::select(max + 1, &rset, &wset, 0, timeout));
-        if (r == -1) { // ow
+    while (!mQuit) {
+        if (!poll(nextTimeout()))
             return;
-        }
-        if (timeout) {
-            gettime(&timenow);
-
-            assert(mTimerData.begin() != mTimerData.end());
-            List<TimerData> copy;
-            {
-                List<TimerData*>::const_iterator it = mTimerData.begin();
-                const List<TimerData*>::const_iterator end = mTimerData.end();
-                while (it != end) {
-                    copy.push_back(*(*it));
-                    ++it;
-                }
-            }
-            List<TimerData>::const_iterator it = copy.begin();
-            const List<TimerData>::const_iterator end = copy.end();
-            if (it != end) {
-                while (true) {
-                    if (!timevalGreaterEqualThan(&timenow, &it->when))
-                        break;
-                    if (reinsertTimer(it->handle, &timenow))
-                        it->callback(it->handle, it->userData);
-                    while (true) {
-                        ++it;
-                        if (it == end || mTimerByHandle.contains(it->handle))
-                            break;
-                    }
-
-                    if (it == end)
-                        break;
-                }
-            }
-        }
-        if (FD_ISSET(mEventPipe[0], &rset))
-            handlePipe();
-        Map<int, FdData> fds = mFdData;
-
-        Map<int, FdData>::const_iterator it = fds.begin();
-        while (it != fds.end()) {
-            if ((it->second.flags & (Read|Disconnected)) && FD_ISSET(it->first, &rset)) {
-                unsigned int flag = it->second.flags & Read;
-                if (it->second.flags & Disconnected) {
-                    size_t nbytes = 0;
-                    int ret = ioctl(it->first, FIONREAD, reinterpret_cast<char*>(&nbytes));
-                    if (!ret && !nbytes) {
-                        flag |= Disconnected;
-                    }
-                }
+    }
+}
 
-                if ((it->second.flags & Write) && FD_ISSET(it->first, &wset))
-                    flag |= Write;
-                it->second.callback(it->first, flag, it->second.userData);
-            } else if ((it->second.flags & Write) && FD_ISSET(it->first, &wset)) {
-                it->second.callback(it->first, Write, it->second.userData);
-            } else {
-                ++it;
-                continue;
-            }
-            do {
-                ++it;
-            } while (it != fds.end() && !mFdData.contains(it->first));
-        }
-        if (mQuit)
-            break;
+// milliseconds until the first timer is due, -1 if there are none
+int EventLoop::nextTimeout()
+{
+    if (mTimerHeap.isEmpty())
+        return -1;
+    timeval now, when = mTimerHeap[0]->when;
+    gettime(&now);
+    timevalSub(&when, &now);
+    // round up, waking up early would just mean another round trip
+    return (when.tv_sec * 1000) + ((when.tv_usec + 999) / 1000);
+}
+
+void EventLoop::fireTimers()
+{
+    if (mTimerHeap.isEmpty())
+        return;
+    timeval now;
+    gettime(&now);
+
+    // take every timer that is due and reschedule it before calling any of
+    // them, the callbacks are free to add and remove timers
+    List<TimerData> due;
+    while (!mTimerHeap.isEmpty() && timevalGreaterEqualThan(&now, &mTimerHeap[0]->when)) {
+        TimerData* data = mTimerHeap[0];
+        due.append(*data);
+        timerHeapRemove(data);
+        // how much over the target time are we?
+        const int overtime = timevalDiff(&now, &data->when);
+        data->when = now;
+        // the next time we want to fire is now + timeout - overtime
+        // but we don't want a negative time
+        timevalAdd(&data->when, std::max(data->timeout - overtime, 0));
+    }
+    for (List<TimerData>::const_iterator it = due.begin(); it != due.end(); ++it)
+        timerHeapPush(mTimerByHandle.value(it->handle));
+
+    for (List<TimerData>::const_iterator it = due.begin(); it != due.end(); ++it) {
+        if (mTimerByHandle.contains(it->handle))
+            it->callback(it->handle, it->userData);
     }
 }
 
-bool EventLoop::reinsertTimer(int handle, timeval* now)
-{
-    // first, find the handle in the list and remove it
-    List<TimerData*>::iterator it = mTimerData.begin();
-    const List<TimerData*>::const_iterator end = mTimerData.end();
-    while (it != end) {
-        if ((*it)->handle == handle) {
-            TimerData* data = *it;
-            mTimerData.erase(it);
-            // how much over the target time are we?
-            const int overtime = timevalDiff(now, &data->when);
-            data->when = *now;
-            // the next time we want to fire is now + timeout - overtime
-            // but we don't want a negative time
-            timevalAdd(&data->when, std::max(data->timeout - overtime, 0));
-            // insert the time so that the list stays sorted by absolute time
-            it = std::lower_bound(mTimerData.begin(), mTimerData.end(),
-                                  data, timerLessThan);
-            mTimerData.insert(it, data);
-            // all done
-            return true;
+static inline bool isDisconnected(int fd)
+{
+    size_t nbytes = 0;
+    const int ret = ioctl(fd, FIONREAD, reinterpret_cast<char*>(&nbytes));
+    return !ret && !nbytes;
+}
+
+#ifdef HAVE_EPOLL
+bool EventLoop::poll(int timeout)
+{
+    enum { MaxEvents = 256 };
+    epoll_event events[MaxEvents];
+    int count;
+    eintrwrap(count, ::epoll_wait(mPollFd, events, MaxEvents, timeout));
+    if (count == -1) { // ow
+        error("EventLoop: epoll_wait failed (%d) %s", errno, strerror(errno));
+        return false;
+    }
+    fireTimers();
+    for (int i=0; i<count; ++i) {
+        if (events[i].data.fd == mEventPipe[0]) {
+            handlePipe();
+            break;
         }
-        ++it;
     }
-    // didn't find our timer handle in the list
-    return false;
+    for (int i=0; i<count; ++i) {
+        const int fd = events[i].data.fd;
+        if (fd == mEventPipe[0])
+            continue;
+        // an earlier callback might have removed it
+        const Map<int, FdData>::const_iterator it = mFdData.find(fd);
+        if (it == mFdData.end())
+            continue;
+        const FdData data = it->second;
+        const uint32_t ev = events[i].events;
+        unsigned int flag = 0;
+        // like select, hangups and errors show up as readable
+        if ((data.flags & Read) && (ev & (EPOLLIN|EPOLLHUP|EPOLLERR))) {
+            flag |= Read;
+            if ((data.flags & Disconnected) && isDisconnected(fd))
+                flag |= Disconnected;
+        }
+        if ((data.flags & Write) && (ev & (EPOLLOUT|EPOLLHUP|EPOLLERR)))
+            flag |= Write;
+        if (flag)
+            data.callback(fd, flag, data.userData);
+    }
+    return true;
 }
+#else
+bool EventLoop::poll(int timeout)
+{
+    fd_set rset, wset;
+    FD_ZERO(&rset);
+    FD_ZERO(&wset);
+    FD_SET(mEventPipe[0], &rset);
+    int max = mEventPipe[0];
+    for (Map<int, FdData>::const_iterator it = mFdData.begin();
+         it != mFdData.end(); ++it) {
+        if (it->second.flags & Read)
+            FD_SET(it->first, &rset);
+        if (it->second.flags & Write)
+            FD_SET(it->first, &wset);
+        max = std::max(max, it->first);
+    }
+    timeval timedata;
+    timeval* time = 0;
+    if (timeout >= 0) {
+        timedata.tv_sec = timeout / 1000;
+        timedata.tv_usec = (timeout % 1000) * 1000;
+        time = &timedata;
+    }
+    int r;
+    // ### use poll instead? easier to catch exactly what fd that was problematic in the EBADF case
+    eintrwrap(r, ::select(max + 1, &rset, &wset, 0, time));
+    if (r == -1) { // ow
+        return false;
+    }
+    fireTimers();
+    if (FD_ISSET(mEventPipe[0], &rset))
+        handlePipe();
+    Map<int, FdData> fds = mFdData;
+
+    Map<int, FdData>::const_iterator it = fds.begin();
+    while (it != fds.end()) {
+        if ((it->second.flags & (Read|Disconnected)) && FD_ISSET(it->first, &rset)) {
+            unsigned int flag = it->second.flags & Read;
+            if ((it->second.flags & Disconnected) && isDisconnected(it->first))
+                flag |= Disconnected;
+
+            if ((it->second.flags & Write) && FD_ISSET(it->first, &wset))
+                flag |= Write;
+            it->second.callback(it->first, flag, it->second.userData);
+        } else if ((it->second.flags & Write) && FD_ISSET(it->first, &wset)) {
+            it->second.callback(it->first, Write, it->second.userData);
+        } else {
+            ++it;
+            continue;
+        }
+        do {
+            ++it;
+        } while (it != fds.end() && !mFdData.contains(it->first));
+    }
+    return true;
+}
+#endif
 
 void EventLoop::handlePipe()
 {
-    char c;
+    char buf[64];
     for (;;) {
         int r;
-        eintrwrap(r, ::read(mEventPipe[0], &c, 1));
-        if (r == 1) {
-            switch (c) {
-            case 'e':
-                sendPostedEvents();
-                break;
-            case 'q':
-                mQuit = true;
-                break;
-            }
-        } else
+        eintrwrap(r, ::read(mEventPipe[0], buf, sizeof(buf)));
+        if (r <= 0)
             break;
     }
+    // clear the flag before draining, anything posted from here on wakes
+    // us up again
+    mWakeupPending = false;
+    if (mQuitPending.exchange(false))
+        mQuit = true;
+    sendPostedEvents();
 }
 
 void EventLoop::sendPostedEvents()
 {
-    MutexLocker locker(&mMutex);
-    while (!mEvents.empty()) {
-        std::deque<EventData>::iterator first = mEvents.begin();
-        EventData data = *first;
-        mEvents.erase(first);
-        locker.unlock();
+    for (;;) {
+        EventData data;
+        {
+            MutexLocker lock(&mEventsMutex);
+            if (mSendingTo) {
+                mSendingTo = 0;
+                mEventsCondition.wakeAll();
+            }
+            // pick up new events and removeEvents markers before each send
+            takePostedEvents();
+            if (mEvents.empty())
+                break;
+            data = mEvents.front();
+            mEvents.pop_front();
+            mSendingTo = data.receiver;
+        }
         data.receiver->event(data.event);
         delete data.event;
-        locker.relock();
     }
 }
 
 void EventLoop::exit()
 {
-    const char q = 'q';
-    int r;
-    do {
-        eintrwrap(r, ::write(mEventPipe[1], &q, 1));
-    } while (r == -1 && (errno == EAGAIN || errno == EWOULDBLOCK));
+    mQuitPending = true;
+    mWakeupPending = true;
+    wakeup();
 }
@@ -1,9 +1,11 @@
 #ifndef EVENTLOOP_H
 #define EVENTLOOP_H
 
+#include "config.h"
 #include "Mutex.h"
 #include "WaitCondition.h"
 #include "Thread.h"
+#include <atomic>
 #include <deque>
 #include <sys/time.h>
 
@@ -35,22 +37,28 @@ public:
     void run();
     pthread_t thread() const { return mThread; }
 
-    // The following two functions are thread safe
+    // the monotonic clock timers run on
+    static bool gettime(timeval* time);
+
+    // The following three functions are thread safe
     void postEvent(EventReceiver* object, Event* event);
     void exit();
     void removeEvents(EventReceiver *e);
 private:
     void handlePipe();
     void sendPostedEvents();
-    bool reinsertTimer(int handle, timeval* now);
+    void wakeup();
+    int nextTimeout();
+    void fireTimers();
+    bool poll(int timeout);
 
 private:
-    int mEventPipe[2];
+    int mEventPipe[2]; // both ends are the same eventfd if we have one
+#ifdef HAVE_EPOLL
+    int mPollFd;
+#endif
     bool mQuit;
 
-    Mutex mMutex;
-    WaitCondition mCond;
-
     struct FdData {
         unsigned int flags;
         FdFunc callback;
@@ -65,17 +73,48 @@ private:
         timeval when;
         TimerFunc callback;
         void* userData;
+        int heapIndex;
     };
-    List<TimerData*> mTimerData;
+    // binary min heap on when, each TimerData knows its index so removal is O(log n)
+    List<TimerData*> mTimerHeap;
     Map<int, TimerData*> mTimerByHandle;
 
     static bool timerLessThan(TimerData* a, TimerData* b);
+    void timerHeapPush(TimerData* data);
+    void timerHeapRemove(TimerData* data);
+    void timerSiftUp(int idx);
+    void timerSiftDown(int idx);
+
+    // Posted events go through an intrusive multi-producer single-consumer
+    // queue (Vyukov's), producers never take a lock. The consumer side is
+    // serialized by mEventsMutex, removeEvents drains it from any thread.
+    // An event of 0 is a marker from removeEvents, it drops everything
+    // queued before it for that receiver.
+    struct EventNode {
+        EventReceiver* receiver;
+        Event* event;
+        std::atomic<EventNode*> next;
+    };
+    std::atomic<EventNode*> mQueueHead; // producers push here
+    EventNode* mQueueTail; // mEventsMutex
+    EventNode mQueueStub;
+    void push(EventNode* node);
+    EventNode* pop();
+    void takePostedEvents(const EventNode* marker = 0);
 
     struct EventData {
         EventReceiver* receiver;
         Event* event;
     };
-    std::deque<EventData> mEvents;
+    Mutex mEventsMutex;
+    WaitCondition mEventsCondition;
+    std::deque<EventData> mEvents; // taken off the queue, not yet sent
+    EventReceiver* mSendingTo; // receiver of the event being sent, removeEvents waits for it
+
+    // set when the loop has been woken and hasn't drained the queue yet, so
+    // a burst of posts costs one write
+    std::atomic<bool> mWakeupPending;
+    std::atomic<bool> mQuitPending;
 
     static EventLoop* sInstance;
 
@@ -24,13 +24,27 @@ void FileManager::recurseDirs()
     Server::instance()->threadPool()->start(job);
 }
 
+void FileManager::scan(const Path &directory)
+{
+    std::shared_ptr<Project> project = mProject.lock();
+    assert(project);
+    std::shared_ptr<GRScanJob> job(new GRScanJob(GRScanJob::All, directory, project));
+    job->finished().connect(this, &FileManager::onScanJobFinished);
+    Server::instance()->threadPool()->start(job);
+}
+
 void FileManager::onRecurseJobFinished(const Set<Path> &paths)
+{
+    mWatcher.clear();
+    onScanJobFinished(paths);
+}
+
+void FileManager::onScanJobFinished(const Set<Path> &paths)
 {
     std::shared_ptr<Project> project = mProject.lock();
     assert(project);
     Scope<FilesMap&> scope = project->lockFilesForWrite();
     FilesMap &map = scope.data();
-    mWatcher.clear();
     for (Set<Path>::const_iterator it = paths.begin(); it != paths.end(); ++it) {
         const Path parent = it->parentDir();
         if (parent.isEmpty()) {
@@ -53,7 +67,8 @@ void FileManager::onFileAdded(const Path &path)
     const GRScanJob::FilterResult res = GRScanJob::filter(path, Server::instance()->excludeFilter());
     switch (res) {
     case GRScanJob::Directory:
-        recurseDirs();
+        // only the new subtree needs to be crawled
+        scan(path);
         return;
     case GRScanJob::Filtered:
         return;
@@ -77,8 +92,17 @@ void FileManager::onFileRemoved(const Path &path)
     std::shared_ptr<Project> project = mProject.lock();
     Scope<FilesMap&> scope = project->lockFilesForWrite();
     FilesMap &map = scope.data();
-    if (map.contains(path)) {
-        recurseDirs();
+    Path dirPath = path;
+    if (!dirPath.endsWith('/'))
+        dirPath.append('/');
+    FilesMap::iterator it = map.lower_bound(dirPath);
+    if (it != map.end() && it->first.startsWith(dirPath)) {
+        // a directory, forget everything under it. It may only have
+        // subdirectories so it doesn't need to be a key itself.
+        while (it != map.end() && it->first.startsWith(dirPath)) {
+            mWatcher.unwatch(it->first);
+            map.erase(it++);
+        }
         return;
     }
     const Path parent = path.parentDir();
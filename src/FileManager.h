@@ -14,9 +14,11 @@ public:
     FileManager();
     void init(const std::shared_ptr<Project> &proj);
     void recurseDirs();
+    void scan(const Path &directory);
     void onFileAdded(const Path &path);
     void onFileRemoved(const Path &path);
-    void onRecurseJobFinished(const Set<Path> &mPaths);
+    void onRecurseJobFinished(const Set<Path> &paths);
+    void onScanJobFinished(const Set<Path> &paths);
     bool contains(const Path &path) const;
 private:
     FileSystemWatcher mWatcher;
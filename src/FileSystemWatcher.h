@@ -4,6 +4,7 @@
 #include "config.h"
 #include "Path.h"
 #include "Map.h"
+#include "Set.h"
 #include "Mutex.h"
 #include "SignalSlot.h"
 #include <stdint.h>
@@ -25,6 +26,8 @@ public:
     signalslot::Signal1<const Path &> &removed() { return mRemoved; }
     signalslot::Signal1<const Path &> &added() { return mAdded; }
     signalslot::Signal1<const Path &> &modified() { return mModified; }
+    // every file modified in one batch of events, emitted after the per path signals
+    signalslot::Signal1<const Set<Path> &> &modifiedFiles() { return mModifiedFiles; }
     void clear();
 #ifdef HAVE_FSEVENTS
     Set<Path> watchedPaths() const;
@@ -43,6 +46,10 @@ private:
     int mFd;
     Map<Path, int> mWatchedByPath;
     Map<int, Path> mWatchedById;
+#ifdef HAVE_INOTIFY
+    time_t mLastRead; // when the event queue was last drained
+    void rescan(time_t since, Set<Path> &modified) const;
+#endif
 #ifdef HAVE_KQUEUE
     Map<Path, uint64_t> mTimes;
     static Path::VisitResult scanFiles(const Path& path, void* userData);
@@ -52,5 +59,6 @@ private:
 #endif
 #endif
     signalslot::Signal1<const Path&> mRemoved, mModified, mAdded;
+    signalslot::Signal1<const Set<Path>&> mModifiedFiles;
 };
 #endif
@@ -58,6 +58,8 @@ void WatcherReceiver::event(const Event* event)
         }
         ++path;
     }
+    if (we->type == WatcherEvent::Modified && !we->paths.isEmpty())
+        watcher->mModifiedFiles(we->paths);
 }
 
 class WatcherThread : public Thread
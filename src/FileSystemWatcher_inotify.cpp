@@ -2,14 +2,17 @@
 #include "EventLoop.h"
 #include "MutexLocker.h"
 #include "Log.h"
+#include "RTags.h"
 #include "config.h"
 #include <sys/inotify.h>
-#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <dirent.h>
 #include <errno.h>
 
 FileSystemWatcher::FileSystemWatcher()
+    : mLastRead(time(0))
 {
-    mFd = inotify_init();
+    mFd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
     assert(mFd != -1);
     EventLoop::instance()->addFileDescriptor(mFd, EventLoop::Read, notifyCallback, this);
 }
@@ -112,49 +115,89 @@ static inline void dump(unsigned mask)
         printf("IN_MOVE_SELF ");
 }
 
+void FileSystemWatcher::rescan(time_t since, Set<Path> &modified) const
+{
+    for (Map<Path, int>::const_iterator it = mWatchedByPath.begin(); it != mWatchedByPath.end(); ++it) {
+        const Path &path = it->first;
+        struct stat st;
+        if (!path.endsWith('/')) {
+            if (!stat(path.constData(), &st) && st.st_mtime >= since)
+                modified.insert(path);
+            continue;
+        }
+        DIR *dir = opendir(path.constData());
+        if (!dir)
+            continue;
+        while (dirent *entry = readdir(dir)) {
+            if (entry->d_type != DT_REG && entry->d_type != DT_UNKNOWN && entry->d_type != DT_LNK)
+                continue;
+            const Path file = path + entry->d_name;
+            if (!stat(file.constData(), &st) && S_ISREG(st.st_mode) && st.st_mtime >= since)
+                modified.insert(file);
+        }
+        closedir(dir);
+    }
+}
+
 void FileSystemWatcher::notifyReadyRead()
 {
     Set<Path> modified, removed, added;
     {
         MutexLocker lock(&mMutex);
-        int s = 0;
-        ioctl(mFd, FIONREAD, &s);
-        if (!s)
-            return;
-        enum { StaticBufSize = 4096 };
-        char staticBuf[StaticBufSize];
-        char *buf = s > StaticBufSize ? new char[s] : staticBuf;
-        const int read = ::read(mFd, buf, s);
-        int idx = 0;
-        while (idx < read) {
-            Path path;
-            inotify_event *event = reinterpret_cast<inotify_event*>(buf + idx);
-            idx += sizeof(inotify_event) + event->len;
-            path = mWatchedById.value(event->wd);
-            // printf("%s [%s]", path.constData(), event->name);
-            // dump(event->mask);
-            // printf("\n");
-
-            const bool isDir = path.isDir();
+        // read whatever is queued in fixed size chunks. Anything left over
+        // once MaxReads is hit is picked up on the next round of the event
+        // loop, that keeps a storm of events from starving everything else
+        enum { BufferSize = 64 * 1024, MaxReads = 16 };
+        char buf[BufferSize] __attribute__((aligned(__alignof__(inotify_event))));
+        const time_t now = time(0);
+        bool overflow = false, drained = false;
+        for (int i=0; i<MaxReads; ++i) {
+            int read;
+            eintrwrap(read, ::read(mFd, buf, BufferSize));
+            if (read <= 0) {
+                drained = true;
+                break;
+            }
+            int idx = 0;
+            while (idx < read) {
+                inotify_event *event = reinterpret_cast<inotify_event*>(buf + idx);
+                idx += sizeof(inotify_event) + event->len;
+                if (event->mask & IN_Q_OVERFLOW) {
+                    overflow = true;
+                    continue;
+                }
+                Path path = mWatchedById.value(event->wd);
+                if (path.isEmpty())
+                    continue; // removed while the event was queued
+                // printf("%s [%s]", path.constData(), event->name);
+                // dump(event->mask);
+                // printf("\n");
 
-            if (event->mask & (IN_DELETE_SELF|IN_MOVE_SELF|IN_UNMOUNT)) {
-                added.insert(path);
-            } else if (event->mask & (IN_CREATE|IN_MOVED_TO)) {
-                path.append(event->name);
-                added.insert(path);
-            } else if (event->mask & (IN_DELETE|IN_MOVED_FROM)) {
-                path.append(event->name);
-                added.remove(path);
-                removed.insert(path);
-            } else if (event->mask & (IN_ATTRIB|IN_CLOSE_WRITE)) {
-                if (isDir) {
+                if (event->mask & (IN_DELETE_SELF|IN_MOVE_SELF|IN_UNMOUNT)) {
+                    added.insert(path);
+                } else if (event->mask & (IN_CREATE|IN_MOVED_TO)) {
                     path.append(event->name);
+                    added.insert(path);
+                } else if (event->mask & (IN_DELETE|IN_MOVED_FROM)) {
+                    path.append(event->name);
+                    added.remove(path);
+                    removed.insert(path);
+                } else if (event->mask & (IN_ATTRIB|IN_CLOSE_WRITE)) {
+                    if (path.endsWith('/'))
+                        path.append(event->name);
+                    modified.insert(path);
                 }
-                modified.insert(path);
             }
         }
-        if (buf != staticBuf)
-            delete []buf;
+        if (overflow) {
+            // the kernel dropped events, look at the mtimes of everything we
+            // watch. The second of slack covers files written while we were
+            // reading the previous batch
+            error("FileSystemWatcher: inotify queue overflowed, rescanning %d paths", mWatchedByPath.size());
+            rescan(mLastRead - 1, modified);
+        }
+        if (drained)
+            mLastRead = now;
     }
 
     struct {
@@ -171,5 +214,7 @@ void FileSystemWatcher::notifyReadyRead()
             signals[i].signal(*it);
         }
     }
+    if (!modified.isEmpty())
+        mModifiedFiles(modified);
     // error() << modified << removed << added;
 }
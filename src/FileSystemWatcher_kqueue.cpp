@@ -326,6 +326,8 @@ void FileSystemWatcher::notifyReadyRead()
                             signals[i].signal(*it);
                         }
                     }
+                    if (!data.modified.isEmpty())
+                        mModifiedFiles(data.modified);
                 }
 
                 for (Set<Path>::const_iterator it = data.all.begin(); it != data.all.end(); ++it) {
@@ -64,10 +64,11 @@ void FindSymbolsJob::execute()
         } else {
             std::sort(sorted.begin(), sorted.end());
         }
-        const uint32_t keyFlags = QueryMessage::keyFlags(queryFlags());
         const int count = sorted.size();
         for (int i=0; i<count; ++i) {
-            write(sorted.at(i).location.key(keyFlags));
+            const RTags::SortedCursor &cursor = sorted.at(i);
+            if (!writeLocation(cursor.location, cursor.kind == CXCursor_FirstInvalid ? 0 : cursor.kind))
+                return;
         }
     }
 }
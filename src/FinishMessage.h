@@ -0,0 +1,19 @@
+#ifndef FinishMessage_h
+#define FinishMessage_h
+
+#include "Message.h"
+#include "ByteArray.h"
+
+// Ends the response to one request of a persistent connection, sent where
+// a normal connection would be closed.
+class FinishMessage : public Message
+{
+public:
+    enum { MessageId = 9 };
+
+    virtual int messageId() const { return MessageId; }
+    ByteArray encode() const { return ByteArray(); }
+    void fromData(const char *, int) {}
+};
+
+#endif
@@ -1,7 +1,15 @@
 #include "GRParser.h"
 #include "GRScanJob.h"
 #include "Server.h"
+#include "Thread.h"
+#include "WaitCondition.h"
+#include <dirent.h>
+#include <fcntl.h>
 #include <fnmatch.h>
+#include <sys/stat.h>
+#ifdef OS_Linux
+#include <sys/syscall.h>
+#endif
 
 GRScanJob::GRScanJob(Mode mode, const Path &path, const std::shared_ptr<Project> &project)
     : mMode(mode), mPath(path), mFilters(Server::instance()->excludeFilter()), mProject(project)
@@ -10,9 +18,261 @@ GRScanJob::GRScanJob(Mode mode, const Path &path, const std::shared_ptr<Project>
         mPath.append('/');
 }
 
+// The exclude filters compiled once per scan. Patterns that are just a
+// literal with a leading and/or trailing * (all of the default ones) are
+// matched with memcmp/strstr, anything else goes through fnmatch.
+class ExcludeMatcher
+{
+public:
+    ExcludeMatcher(const List<ByteArray> &filters)
+    {
+        const int count = filters.size();
+        for (int i=0; i<count; ++i) {
+            const ByteArray &filter = filters.at(i);
+            Pattern pattern;
+            pattern.type = Pattern::Glob;
+            pattern.pattern = filter;
+            const int size = filter.size();
+            const bool leading = size && filter.at(0) == '*';
+            const bool trailing = size > 1 && filter.at(size - 1) == '*';
+            const ByteArray literal = filter.mid(leading ? 1 : 0, size - (leading ? 1 : 0) - (trailing ? 1 : 0));
+            if (!strpbrk(literal.constData(), "*?[\\")) {
+                pattern.pattern = literal;
+                if (leading && trailing) {
+                    pattern.type = Pattern::Contains;
+                } else if (leading) {
+                    pattern.type = Pattern::Suffix;
+                } else if (trailing) {
+                    pattern.type = Pattern::Prefix;
+                } else {
+                    pattern.type = Pattern::Exact;
+                }
+            }
+            mPatterns.append(pattern);
+        }
+    }
+
+    bool isExcluded(const char *path, int length) const
+    {
+        const int count = mPatterns.size();
+        for (int i=0; i<count; ++i) {
+            const Pattern &pattern = mPatterns.at(i);
+            const int size = pattern.pattern.size();
+            switch (pattern.type) {
+            case Pattern::Exact:
+                if (length == size && !memcmp(path, pattern.pattern.constData(), size))
+                    return true;
+                break;
+            case Pattern::Prefix:
+                if (length >= size && !memcmp(path, pattern.pattern.constData(), size))
+                    return true;
+                break;
+            case Pattern::Suffix:
+                if (length >= size && !memcmp(path + length - size, pattern.pattern.constData(), size))
+                    return true;
+                break;
+            case Pattern::Contains:
+                if (strstr(path, pattern.pattern.constData()))
+                    return true;
+                break;
+            case Pattern::Glob:
+                if (!fnmatch(pattern.pattern.constData(), path, 0))
+                    return true;
+                break;
+            }
+        }
+        return false;
+    }
+private:
+    struct Pattern {
+        enum Type { Exact, Prefix, Suffix, Contains, Glob } type;
+        ByteArray pattern;
+    };
+    List<Pattern> mPatterns;
+};
+
+class CrawlerThread;
+
+// Directories still to be read, shared by the crawler threads. Each thread
+// takes one directory at a time and queues the subdirectories it finds.
+// The job's own thread crawls too, another thread is only started when
+// directories are waiting and we're below maxThreads, so rescanning a new
+// directory doesn't spin up a pool.
+struct CrawlState {
+    CrawlState(const List<ByteArray> &filters, bool sourcesOnly, GRScanJob *job, int maxThreads)
+        : matcher(filters), sourcesOnly(sourcesOnly), busy(0), job(job), maxThreads(maxThreads)
+    {}
+
+    const ExcludeMatcher matcher;
+    const bool sourcesOnly;
+    Mutex mutex;
+    WaitCondition condition;
+    List<Path> directories;
+    int busy;
+    Set<std::pair<dev_t, ino_t> > links; // directories we got to through symlinks
+    GRScanJob *job;
+    const int maxThreads; // including the job's thread
+    List<CrawlerThread*> threads;
+};
+
+class CrawlerThread : public Thread
+{
+public:
+    CrawlerThread(CrawlState *state)
+        : mState(state)
+    {}
+
+    Set<Path> paths;
+
+    void crawl()
+    {
+        List<Path> subdirs;
+        while (true) {
+            Path dir;
+            {
+                MutexLocker lock(&mState->mutex);
+                while (mState->directories.isEmpty() && mState->busy)
+                    mState->condition.wait(&mState->mutex);
+                if (mState->directories.isEmpty() || mState->job->isAborted()) {
+                    mState->directories.clear();
+                    mState->condition.wakeAll();
+                    return;
+                }
+                dir = mState->directories.at(mState->directories.size() - 1);
+                mState->directories.removeLast();
+                ++mState->busy;
+            }
+            subdirs.clear();
+            scan(dir, subdirs);
+            MutexLocker lock(&mState->mutex);
+            mState->directories.append(subdirs);
+            if (mState->directories.size() > 1 && mState->threads.size() + 1 < mState->maxThreads) {
+                CrawlerThread *thread = new CrawlerThread(mState);
+                mState->threads.append(thread);
+                thread->start();
+            }
+            if (!--mState->busy || !subdirs.isEmpty())
+                mState->condition.wakeAll();
+        }
+    }
+protected:
+    virtual void run()
+    {
+        crawl();
+    }
+private:
+    void add(Path &path, unsigned char type, List<Path> &subdirs)
+    {
+        struct stat st;
+        if (type == DT_UNKNOWN || type == DT_LNK) {
+            if (stat(path.constData(), &st))
+                return;
+            if (S_ISDIR(st.st_mode)) {
+                if (type == DT_LNK) {
+                    MutexLocker lock(&mState->mutex);
+                    if (!mState->links.insert(std::make_pair(st.st_dev, st.st_ino)))
+                        return; // been there, symlink loops would never end
+                }
+                type = DT_DIR;
+            } else if (S_ISREG(st.st_mode)) {
+                type = DT_REG;
+            } else {
+                return;
+            }
+        }
+        switch (type) {
+        case DT_DIR:
+            path.append('/');
+            if (!mState->matcher.isExcluded(path.constData(), path.size()))
+                subdirs.append(path);
+            break;
+        case DT_REG:
+            if (!mState->matcher.isExcluded(path.constData(), path.size())) {
+                if (mState->sourcesOnly) {
+                    const char *ext = path.extension();
+                    if (!ext || (!Path::isSource(ext) && !Path::isHeader(ext)))
+                        break;
+                }
+                paths.insert(path);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    static inline bool isDots(const char *name)
+    {
+        return name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2]));
+    }
+
+    void scan(const Path &dir, List<Path> &subdirs)
+    {
+        Path path = dir;
+        const int size = path.size();
+#ifdef OS_Linux
+        // getdents64 fills a whole buffer of entries per syscall and gives
+        // us d_type so only symlinks and odd filesystems need a stat
+        struct linux_dirent64 {
+            ino64_t d_ino;
+            off64_t d_off;
+            unsigned short d_reclen;
+            unsigned char d_type;
+            char d_name[];
+        };
+        const int fd = open(dir.constData(), O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+        if (fd == -1)
+            return;
+        enum { BufferSize = 32 * 1024 };
+        char buf[BufferSize] __attribute__((aligned(8)));
+        while (true) {
+            const int read = syscall(SYS_getdents64, fd, buf, BufferSize);
+            if (read <= 0)
+                break;
+            for (int idx = 0; idx < read; ) {
+                const linux_dirent64 *entry = reinterpret_cast<const linux_dirent64*>(buf + idx);
+                idx += entry->d_reclen;
+                if (isDots(entry->d_name))
+                    continue;
+                path.truncate(size);
+                path.append(entry->d_name);
+                add(path, entry->d_type, subdirs);
+            }
+        }
+        close(fd);
+#else
+        DIR *d = opendir(dir.constData());
+        if (!d)
+            return;
+        while (const dirent *entry = readdir(d)) {
+            if (isDots(entry->d_name))
+                continue;
+            path.truncate(size);
+            path.append(entry->d_name);
+            add(path, entry->d_type, subdirs);
+        }
+        closedir(d);
+#endif
+    }
+
+    CrawlState *mState;
+};
+
 void GRScanJob::run()
 {
-    mPath.visit(&GRScanJob::visit, this);
+    enum { MaxThreads = 8 };
+    CrawlState state(mFilters, mMode == Sources, this,
+                     std::max(1, std::min<int>(MaxThreads, ThreadPool::idealThreadCount())));
+    state.directories.append(mPath);
+    CrawlerThread crawler(&state);
+    crawler.crawl();
+    mPaths = crawler.paths;
+    // the crawl is over once ours returns, no more threads get started
+    for (int i=0; i<state.threads.size(); ++i) {
+        state.threads.at(i)->join();
+        mPaths.unite(state.threads.at(i)->paths);
+        delete state.threads.at(i);
+    }
     if (std::shared_ptr<Project> project = mProject.lock())
         mFinished(mPaths);
 }
@@ -34,23 +294,3 @@ GRScanJob::FilterResult GRScanJob::filter(const Path &path, const List<ByteArray
         return Source;
     return File;
 }
-
-Path::VisitResult GRScanJob::visit(const Path &path, void *userData)
-{
-    GRScanJob *recurseJob = reinterpret_cast<GRScanJob*>(userData);
-    const FilterResult result = filter(path, recurseJob->mFilters);
-    switch (result) {
-    case Filtered:
-        return Path::Continue;
-    case Directory:
-        return Path::Recurse;
-    case File:
-        if (recurseJob->mMode == Sources)
-            break;
-        // fall through
-    case Source:
-        recurseJob->mPaths.insert(path);
-        break;
-    }
-    return Path::Continue;
-}
@@ -28,7 +28,6 @@ public:
     static FilterResult filter(const Path &path, const List<ByteArray> &filters);
 private:
     const Mode mMode;
-    static Path::VisitResult visit(const Path &path, void *userData);
     Path mPath;
     const List<ByteArray> &mFilters;
     Set<Path> mPaths;
@@ -16,13 +16,13 @@ void GRTags::init(const std::shared_ptr<Project> &project)
 {
     assert(project);
     mProject = project;
-    recurse();
+    recurse(project->srcRoot);
 }
 
-void GRTags::recurse()
+void GRTags::recurse(const Path &directory)
 {
     std::shared_ptr<Project> project = mProject.lock();
-    GRScanJob *job = new GRScanJob(GRScanJob::Sources, project->srcRoot, project);
+    GRScanJob *job = new GRScanJob(GRScanJob::Sources, directory, project);
     job->finished().connect(this, &GRTags::onRecurseJobFinished);
     Server::instance()->threadPool()->start(std::shared_ptr<ThreadPool::Job>(job));
 }
@@ -37,7 +37,7 @@ void GRTags::onFileAdded(const Path &path)
     const GRScanJob::FilterResult res = GRScanJob::filter(path, Server::instance()->excludeFilter());
     switch (res) {
     case GRScanJob::Directory:
-        recurse();
+        recurse(path); // only the new subtree needs to be crawled
         break;
     case GRScanJob::Source:
         add(path);
@@ -13,7 +13,7 @@ public:
     void onFileAdded(const Path &path);
     void onFileRemoved(const Path &path);
     void onRecurseJobFinished(const Set<Path> &files);
-    void recurse();
+    void recurse(const Path &directory);
     void add(const Path &source);
     void onParseJobFinished(const std::shared_ptr<GRParseJob> &job, const GRMap &data);
     void dirty(uint32_t fileId, GRMap &map);
@@ -13,9 +13,9 @@
 #include <math.h>
 
 Indexer::Indexer(const std::shared_ptr<Project> &proj, bool validate)
-    : mJobCounter(0), mInMakefile(false), mModifiedFilesTimerId(-1), mTimerRunning(false), mProject(proj), mValidate(validate)
+    : mJobCounter(0), mDeclarationJobs(0), mInMakefile(false), mModifiedFilesTimerId(-1), mUnsavedFilesTimerId(-1), mTimerRunning(false), mProject(proj), mValidate(validate)
 {
-    mWatcher.modified().connect(this, &Indexer::onFileModified);
+    mWatcher.modifiedFiles().connect(this, &Indexer::onFilesModified);
 }
 
 static inline bool isFile(uint32_t fileId)
@@ -27,16 +27,32 @@ void Indexer::onJobFinished(const std::shared_ptr<IndexerJob> &job)
 {
     MutexLocker lock(&mMutex);
     const uint32_t fileId = job->fileId();
-    mVisitedFilesByJob.remove(job);
+    const Set<uint32_t> visited = mVisitedFilesByJob.take(job);
     if (mJobs.value(fileId) != job) {
         return;
     }
     mJobs.remove(fileId);
+    if (job->flags() & IndexerJob::Declarations)
+        --mDeclarationJobs;
     if (job->isAborted()) {
         return;
     }
+    mProfiler.add(job->profile());
     std::shared_ptr<IndexData> data = job->data();
     mPendingData[fileId] = data;
+    if (job->flags() & IndexerJob::Declarations) {
+        mDeclarations[fileId] = visited;
+    } else if (job->flags() & IndexerJob::References) {
+        // replaces what the first tier wrote for these files
+        mPendingDirtyFiles.unite(visited);
+    }
+    for (Map<uint32_t, uint64_t>::const_iterator it = data->hashes.begin(); it != data->hashes.end(); ++it) {
+        if (it->second) {
+            mHashes[it->first] = it->second;
+        } else {
+            mHashes.remove(it->first);
+        }
+    }
 
     const int idx = mJobCounter - mJobs.size();
 
@@ -57,11 +73,21 @@ void Indexer::index(const SourceInformation &c, unsigned indexerJobFlags)
     if (fileFilter && !strstr(c.sourceFile.constData(), fileFilter))
         return;
 
+    startJob(c, indexerJobFlags);
+}
+
+void Indexer::startJob(const SourceInformation &c, unsigned indexerJobFlags) // lock always held
+{
     const uint32_t fileId = Location::insertFile(c.sourceFile);
+    // sources that have never been parsed get a quick declarations-only pass first
+    if (indexerJobFlags & IndexerJob::Makefile && !mSources.value(fileId).parsed)
+        indexerJobFlags |= IndexerJob::Declarations;
     std::shared_ptr<IndexerJob> &job = mJobs[fileId];
     if (job) {
         if (job->abortIfStarted()) {
             mVisitedFiles -= mVisitedFilesByJob.take(job);
+            if (job->flags() & IndexerJob::Declarations)
+                --mDeclarationJobs;
         } else {
             // it hasn't started yet so no reason to do anything
             return;
@@ -70,7 +96,9 @@ void Indexer::index(const SourceInformation &c, unsigned indexerJobFlags)
     mSources[fileId] = c;
     mPendingData.remove(fileId);
 
-    job.reset(new IndexerJob(shared_from_this(), indexerJobFlags, c.sourceFile, c.args));
+    job.reset(new IndexerJob(shared_from_this(), indexerJobFlags, c.sourceFile, c.args(), mUnsavedFiles));
+    if (indexerJobFlags & IndexerJob::Declarations)
+        ++mDeclarationJobs;
 
     ++mJobCounter;
     if (!mTimerRunning) {
@@ -81,13 +109,73 @@ void Indexer::index(const SourceInformation &c, unsigned indexerJobFlags)
     Server::instance()->threadPool()->start(job, job->priority());
 }
 
-void Indexer::onFileModified(const Path &file)
+// Forgets every source that isn't in keep, and the headers only they
+// included. Their symbols go away with the next write.
+int Indexer::pruneSources(const Set<uint32_t> &keep)
 {
-    // error() << file << "was modified";
-    const uint32_t fileId = Location::fileId(file);
-    if (!fileId)
+    MutexLocker lock(&mMutex);
+    Set<uint32_t> removed;
+    SourceInformationMap::iterator it = mSources.begin();
+    while (it != mSources.end()) {
+        if (keep.contains(it->first)) {
+            ++it;
+            continue;
+        }
+        const uint32_t fileId = it->first;
+        removed.insert(fileId);
+        mSources.erase(it++);
+        const Map<uint32_t, std::shared_ptr<IndexerJob> >::iterator job = mJobs.find(fileId);
+        if (job != mJobs.end()) {
+            job->second->abort();
+            mVisitedFiles -= mVisitedFilesByJob.take(job->second);
+            if (job->second->flags() & IndexerJob::Declarations)
+                --mDeclarationJobs;
+            mJobs.erase(job);
+        }
+        mPendingData.remove(fileId);
+        mDeclarations.remove(fileId);
+    }
+    if (removed.isEmpty())
+        return 0;
+
+    Set<uint32_t> dirtyFiles = removed;
+    DependencyMap::iterator dep = mDependencies.begin();
+    while (dep != mDependencies.end()) {
+        dep->second -= removed;
+        if (dep->second.isEmpty() || (dep->second.size() == 1 && dep->second.contains(dep->first))) {
+            dirtyFiles.insert(dep->first);
+            mDependencies.erase(dep++);
+        } else {
+            ++dep;
+        }
+    }
+    for (Set<uint32_t>::const_iterator file = dirtyFiles.begin(); file != dirtyFiles.end(); ++file)
+        mHashes.remove(*file);
+    mVisitedFiles -= dirtyFiles;
+    mPendingDirtyFiles.unite(dirtyFiles);
+    mUsrs.dirty(dirtyFiles);
+    return removed.size();
+}
+
+void Indexer::onFilesModified(const Set<Path> &files)
+{
+    // error() << files << "were modified";
+    bool found = false;
+    {
+        MutexLocker lock(&mMutex);
+        for (Set<Path>::const_iterator it = files.begin(); it != files.end(); ++it) {
+            const uint32_t fileId = Location::fileId(*it);
+            if (!fileId)
+                continue;
+            // the editor saved the buffer, disk is the truth again
+            mUnsavedFiles.remove(*it);
+            mModifiedUnsavedFiles.remove(fileId);
+            mModifiedFiles.insert(fileId);
+            found = true;
+        }
+    }
+    if (!found)
         return;
-    mModifiedFiles.insert(fileId);
     if (mModifiedFilesTimerId != -1) {
         EventLoop::instance()->removeTimer(mModifiedFilesTimerId);
         mModifiedFilesTimerId = -1;
@@ -214,60 +302,201 @@ int Indexer::reindex(const ByteArray &pattern, bool regexp)
         if (dirty.isEmpty())
             return 0;
         mModifiedFiles += dirty;
+        // explicitly asked for, reindex even if the content is the same
+        for (Set<uint32_t>::const_iterator it = dirty.begin(); it != dirty.end(); ++it)
+            mHashes.remove(*it);
     }
     onFilesModifiedTimeout();
     return dirty.size();
 }
 
+bool Indexer::setUnsavedFile(const Path &path, const ByteArray &contents)
+{
+    const uint32_t fileId = Location::fileId(path);
+    if (!fileId)
+        return false;
+    {
+        MutexLocker lock(&mMutex);
+        if (!mDependencies.contains(fileId))
+            return false;
+        UnsavedFilesMap::iterator it = mUnsavedFiles.find(path);
+        if (it != mUnsavedFiles.end() && it->second == contents)
+            return true;
+        mUnsavedFiles[path] = contents;
+        mModifiedUnsavedFiles.insert(fileId);
+    }
+    // restart the timer on every update so a burst of keystrokes results in one parse
+    if (mUnsavedFilesTimerId != -1)
+        EventLoop::instance()->removeTimer(mUnsavedFilesTimerId);
+    enum { Timeout = 250 };
+    mUnsavedFilesTimerId = EventLoop::instance()->addTimer(Timeout, &Indexer::onUnsavedFilesTimeout, this);
+    return true;
+}
+
+bool Indexer::clearUnsavedFile(const Path &path)
+{
+    const uint32_t fileId = Location::fileId(path);
+    if (!fileId)
+        return false;
+    {
+        MutexLocker lock(&mMutex);
+        if (!mUnsavedFiles.contains(path))
+            return false;
+        // every job that ran since it was set parsed the editor's contents,
+        // forget the hashes so all the includers get reindexed from disk
+        mHashes.remove(fileId);
+    }
+    Set<Path> files;
+    files.insert(path);
+    onFilesModified(files); // drops the contents
+    return true;
+}
+
+UnsavedFilesMap Indexer::unsavedFiles() const
+{
+    MutexLocker lock(&mMutex);
+    return mUnsavedFiles;
+}
+
+void Indexer::onUnsavedFilesTimeout()
+{
+    mUnsavedFilesTimerId = -1;
+    Map<uint32_t, SourceInformation> toIndex;
+    {
+        MutexLocker lock(&mMutex);
+        Set<uint32_t> dirtyFiles;
+        for (Set<uint32_t>::const_iterator it = mModifiedUnsavedFiles.begin(); it != mModifiedUnsavedFiles.end(); ++it) {
+            SourceInformationMap::const_iterator source = mSources.find(*it);
+            if (source == mSources.end()) {
+                // a header, reparsing one translation unit that includes it is enough
+                const Set<uint32_t> deps = mDependencies.value(*it);
+                for (Set<uint32_t>::const_iterator d = deps.begin(); d != deps.end(); ++d) {
+                    source = mSources.find(*d);
+                    if (source != mSources.end())
+                        break;
+                }
+                if (source == mSources.end())
+                    continue;
+            }
+            dirtyFiles.insert(*it);
+            dirtyFiles.insert(source->first);
+            toIndex[source->first] = source->second;
+        }
+        mVisitedFiles -= dirtyFiles;
+        mPendingDirtyFiles.unite(dirtyFiles);
+        mUsrs.dirty(dirtyFiles);
+        mModifiedUnsavedFiles.clear();
+    }
+    for (Map<uint32_t, SourceInformation>::const_iterator it = toIndex.begin(); it != toIndex.end(); ++it)
+        index(it->second, IndexerJob::Unsaved|IndexerJob::Dirty);
+}
+
 void Indexer::onValidateDBJobErrors(const Set<Location> &errors)
 {
     MutexLocker lock(&mMutex);
     mPreviousErrors = errors;
 }
 
+// Hashes the modified files on the thread pool, hashing a large header or
+// a branch switch worth of files would stall the event loop.
+class ModifiedFilesJob : public ThreadPool::Job
+{
+public:
+    typedef Map<uint32_t, uint64_t> Hashes;
+    ModifiedFilesJob(const std::shared_ptr<Indexer> &indexer, const Hashes &hashes)
+        : mIndexer(indexer), mHashes(hashes)
+    {}
+protected:
+    virtual void run()
+    {
+        // branch switches and build systems rewrite files without changing
+        // them, don't reindex everything that includes those
+        Set<uint32_t> changed;
+        for (Hashes::const_iterator it = mHashes.begin(); it != mHashes.end(); ++it) {
+            const Path path = Location::path(it->first);
+            if (it->second && RTags::hashFile(path) == it->second) {
+                debug() << path << "is unchanged";
+            } else {
+                changed.insert(it->first);
+            }
+        }
+        if (changed.isEmpty())
+            return;
+        if (std::shared_ptr<Indexer> indexer = mIndexer.lock())
+            indexer->onFilesHashed(changed);
+    }
+private:
+    std::weak_ptr<Indexer> mIndexer;
+    const Hashes mHashes;
+};
+
 void Indexer::onFilesModifiedTimeout()
+{
+    ModifiedFilesJob::Hashes modified;
+    {
+        MutexLocker lock(&mMutex);
+        for (Set<uint32_t>::const_iterator it = mModifiedFiles.begin(); it != mModifiedFiles.end(); ++it)
+            modified[*it] = mHashes.value(*it);
+        mModifiedFiles.clear();
+    }
+    if (!modified.isEmpty()) {
+        std::shared_ptr<ModifiedFilesJob> job(new ModifiedFilesJob(shared_from_this(), modified));
+        Server::instance()->threadPool()->start(job, Job::Priority);
+    }
+}
+
+void Indexer::onFilesHashed(const Set<uint32_t> &changed)
 {
     Set<uint32_t> dirtyFiles;
-    Map<Path, List<ByteArray> > toIndex;
     {
         MutexLocker lock(&mMutex);
-        for (Set<uint32_t>::const_iterator it = mModifiedFiles.begin(); it != mModifiedFiles.end(); ++it) {
+        for (Set<uint32_t>::const_iterator it = changed.begin(); it != changed.end(); ++it) {
+            // file ids are global, this may well be some other project's file
+            const DependencyMap::const_iterator deps = mDependencies.find(*it);
+            if (deps == mDependencies.end())
+                continue;
             dirtyFiles.insert(*it);
-            dirtyFiles.unite(mDependencies.at(*it));
+            dirtyFiles.unite(deps->second);
+            mHashes.remove(*it);
         }
+        if (dirtyFiles.isEmpty())
+            return;
         mVisitedFiles -= dirtyFiles;
         mPendingDirtyFiles.unite(dirtyFiles);
-        mModifiedFiles.clear();
-    }
-    for (Set<uint32_t>::const_iterator it = dirtyFiles.begin(); it != dirtyFiles.end(); ++it) {
-        const SourceInformationMap::const_iterator found = mSources.find(*it);
-        if (found != mSources.end()) {
-            index(found->second, IndexerJob::Dirty);
+        mUsrs.dirty(dirtyFiles);
+        for (Set<uint32_t>::const_iterator it = dirtyFiles.begin(); it != dirtyFiles.end(); ++it) {
+            const SourceInformationMap::const_iterator found = mSources.find(*it);
+            if (found != mSources.end())
+                startJob(found->second, IndexerJob::Dirty);
         }
     }
 }
 
-static inline void writeSymbolNames(const SymbolNameMap &symbolNames, Scope<SymbolNameMap&> &cur)
+static inline void writeSymbolNames(const List<IndexData::SymbolName> &symbolNames, Scope<SymbolNameMap&> &cur)
 {
     SymbolNameMap &current = cur.data();
-    SymbolNameMap::const_iterator it = symbolNames.begin();
-    const SymbolNameMap::const_iterator end = symbolNames.end();
-    while (it != end) {
-        Set<Location> &value = current[it->first];
-        value.unite(it->second);
-        ++it;
+    const int count = symbolNames.size();
+    int i = 0;
+    while (i < count) {
+        // sorted, so each name is looked up once
+        const IndexData::SymbolName &name = symbolNames.at(i);
+        Set<Location> &value = current[ByteArray(name.name, name.length)];
+        do {
+            value.insert(symbolNames.at(i++).location);
+        } while (i < count && symbolNames.at(i).length == name.length
+                 && !memcmp(symbolNames.at(i).name, name.name, name.length));
     }
 }
 
-static inline void writeCursors(const SymbolMap &symbols, Scope<SymbolMap&> &cur)
+static inline void writeCursors(const IndexData::Symbols &symbols, Scope<SymbolMap&> &cur)
 {
     if (!symbols.isEmpty()) {
         SymbolMap &current = cur.data();
         if (current.isEmpty()) {
-            current = symbols;
+            current.insert(symbols.begin(), symbols.end());
         } else {
-            SymbolMap::const_iterator it = symbols.begin();
-            const SymbolMap::const_iterator end = symbols.end();
+            IndexData::Symbols::const_iterator it = symbols.begin();
+            const IndexData::Symbols::const_iterator end = symbols.end();
             while (it != end) {
                 SymbolMap::iterator cur = current.find(it->first);
                 if (cur == current.end()) {
@@ -281,31 +510,47 @@ static inline void writeCursors(const SymbolMap &symbols, Scope<SymbolMap&> &cur
     }
 }
 
-static inline void writeReferences(const ReferenceMap &references, Scope<SymbolMap&> &cur)
+static inline void writeReferences(const List<IndexData::Reference> &references, Scope<SymbolMap&> &cur)
 {
     SymbolMap &symbols = cur.data();
-    if (!references.isEmpty()) {
-        const ReferenceMap::const_iterator end = references.end();
-        for (ReferenceMap::const_iterator it = references.begin(); it != end; ++it) {
-            const Map<Location, RTags::ReferenceType> &refs = it->second;
-            for (Map<Location, RTags::ReferenceType>::const_iterator rit = refs.begin(); rit != refs.end(); ++rit) {
-                CursorInfo &ci = symbols[rit->first];
-                if (rit->second != RTags::NormalReference) {
-                    CursorInfo &other = symbols[it->first];
-                    // error() << "trying to join" << it->first << "and" << it->second.front();
-                    other.targets.insert(rit->first);
-                    ci.targets.insert(it->first);
-                } else {
-                    ci.references.insert(it->first);
-                }
-            }
+    const List<IndexData::Reference>::const_iterator end = references.end();
+    for (List<IndexData::Reference>::const_iterator it = references.begin(); it != end; ++it) {
+        CursorInfo &ci = symbols[it->target];
+        if (it->type != RTags::NormalReference) {
+            CursorInfo &other = symbols[it->location];
+            // error() << "trying to join" << it->location << "and" << it->target;
+            other.targets.insert(it->target);
+            ci.targets.insert(it->location);
+        } else {
+            ci.references.insert(it->location);
         }
     }
 }
 
+// links declarations and definitions that ended up in different units, in
+// whichever order those units were written
+static inline void writeUsrs(const List<UsrTable::Entry> &entries, const UsrTable &usrs, Scope<SymbolMap&> &cur)
+{
+    SymbolMap &symbols = cur.data();
+    for (List<UsrTable::Entry>::const_iterator it = entries.begin(); it != entries.end(); ++it) {
+        const SymbolMap::iterator sym = symbols.find(it->location);
+        if (sym == symbols.end())
+            continue;
+        const UsrTable::Kind other = it->kind == UsrTable::Declaration ? UsrTable::Definition : UsrTable::Declaration;
+        const Set<Location> &locations = usrs.find(it->usr, other);
+        for (Set<Location>::const_iterator loc = locations.begin(); loc != locations.end(); ++loc) {
+            const SymbolMap::iterator target = symbols.find(*loc);
+            if (target != symbols.end()) {
+                sym->second.targets.insert(*loc);
+                target->second.targets.insert(it->location);
+            }
+        }
+    }
+}
 
 void Indexer::write()
 {
+    const uint64_t start = Profiler::now();
     std::shared_ptr<Project> proj = project();
     Scope<SymbolMap&> symbols = proj->lockSymbolsForWrite();
     Scope<SymbolNameMap&> symbolNames = proj->lockSymbolNamesForWrite();
@@ -323,7 +568,11 @@ void Indexer::write()
         writeCursors(data->symbols, symbols);
         writeReferences(data->references, symbols);
         writeSymbolNames(data->symbolNames, symbolNames);
+        for (List<UsrTable::Entry>::const_iterator usr = data->usrs.begin(); usr != data->usrs.end(); ++usr)
+            mUsrs.insert(*usr);
     }
+    for (Map<uint32_t, std::shared_ptr<IndexData> >::iterator it = mPendingData.begin(); it != mPendingData.end(); ++it)
+        writeUsrs(it->second->usrs, mUsrs, symbols);
     Timer timer;
     for (Set<uint32_t>::const_iterator it = newFiles.begin(); it != newFiles.end(); ++it) {
         const Path dir = Location::path(*it).parentDir();
@@ -332,6 +581,13 @@ void Indexer::write()
         }
     }
     mPendingData.clear();
+    mProfiler.addWrite(Profiler::now() - start);
+}
+
+List<ByteArray> Indexer::profile() const
+{
+    MutexLocker lock(&mMutex);
+    return mProfiler.format();
 }
 
 void Indexer::beginMakefile()
@@ -349,7 +605,27 @@ void Indexer::endMakefile()
 
 void Indexer::checkFinished() // lock always held
 {
-    if (mJobs.isEmpty() && !mInMakefile) {
+    if (mInMakefile)
+        return;
+    if (!mDeclarations.isEmpty()) {
+        if (mDeclarationJobs)
+            return;
+        // make the first tier available right away, then queue the second
+        // tier at a lower priority than anything else
+        write();
+        error() << "Declarations for" << mDeclarations.size() << "files took"
+                << ((double)(mTimer.elapsed()) / 1000.0) << "secs";
+        for (Map<uint32_t, Set<uint32_t> >::const_iterator it = mDeclarations.begin(); it != mDeclarations.end(); ++it) {
+            mVisitedFiles -= it->second;
+            if (!mJobs.contains(it->first)) {
+                const SourceInformationMap::const_iterator source = mSources.find(it->first);
+                if (source != mSources.end())
+                    startJob(source->second, IndexerJob::References);
+            }
+        }
+        mDeclarations.clear();
+    }
+    if (mJobs.isEmpty()) {
         mTimerRunning = false;
         const int elapsed = mTimer.restart();
         write();
@@ -397,12 +673,31 @@ DependencyMap Indexer::dependencies() const
 bool Indexer::save(Serializer &out)
 {
     MutexLocker lock(&mMutex);
-    out << mDependencies << mSources << mVisitedFiles;
+    // argument lists are shared by most sources, each distinct one is
+    // written once and the sources refer to it by index
+    Map<uint32_t, int> indexes;
+    List<List<ByteArray> > arguments;
+    for (SourceInformationMap::const_iterator it = mSources.begin(); it != mSources.end(); ++it) {
+        int &index = indexes[it->second.argsId];
+        if (!index) {
+            arguments.append(it->second.args());
+            index = arguments.size();
+        }
+    }
+    out << mDependencies << arguments << static_cast<int>(mSources.size());
+    for (SourceInformationMap::const_iterator it = mSources.begin(); it != mSources.end(); ++it) {
+        const SourceInformation &source = it->second;
+        out << it->first << source.sourceFile << indexes.value(source.argsId) - 1
+            << source.compiler << source.parsed;
+    }
+    out << mVisitedFiles << mHashes;
+    mUsrs.save(out);
     return true;
 }
 
 static inline bool isDirty(uint32_t fileId, time_t time)
 {
+    // ModifiedFilesJob checks whether the content changed
     return Location::path(fileId).lastModified() > time;
 }
 
@@ -411,7 +706,26 @@ bool Indexer::restore(Deserializer &in)
     bool dirtyFiles = false;
     {
         MutexLocker lock(&mMutex);
-        in >> mDependencies >> mSources >> mVisitedFiles;
+        List<List<ByteArray> > arguments;
+        int count;
+        in >> mDependencies >> arguments >> count;
+        List<uint32_t> ids(arguments.size());
+        for (int i=0; i<arguments.size(); ++i)
+            ids[i] = ArgumentsTable::insert(arguments.at(i));
+        for (int i=0; i<count; ++i) {
+            uint32_t fileId;
+            int index;
+            SourceInformation source;
+            in >> fileId >> source.sourceFile >> index >> source.compiler >> source.parsed;
+            if (index < 0 || index >= ids.size()) {
+                error("Invalid arguments index %d for %s", index, source.sourceFile.constData());
+                return false;
+            }
+            source.argsId = ids.at(index);
+            mSources[fileId] = source;
+        }
+        in >> mVisitedFiles >> mHashes;
+        mUsrs.restore(in);
 
         DependencyMap reversedDependencies;
         // these dependencies are in the form of:
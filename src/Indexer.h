@@ -8,7 +8,9 @@
 #include "ReadWriteLock.h"
 #include "ThreadPool.h"
 #include "Timer.h"
+#include "Profiler.h"
 #include "Project.h"
+#include "UsrTable.h"
 #include <clang-c/Index.h>
 
 struct IndexData;
@@ -25,20 +27,27 @@ public:
     ByteArray fixIts(const Path &path) const;
     ByteArray errors(const Path &path = Path()) const;
     int reindex(const ByteArray &pattern, bool regexp);
+    bool setUnsavedFile(const Path &path, const ByteArray &contents);
+    bool clearUnsavedFile(const Path &path);
+    int pruneSources(const Set<uint32_t> &keep);
+    UnsavedFilesMap unsavedFiles() const;
+    List<ByteArray> profile() const;
     signalslot::Signal2<std::shared_ptr<Indexer>, int> &jobsComplete() { return mJobsComplete; }
     signalslot::Signal2<std::shared_ptr<Indexer>, Path> &jobStarted() { return mJobStarted; }
     std::shared_ptr<Project> project() const { return mProject.lock(); }
     void beginMakefile();
     void endMakefile();
     void onJobFinished(const std::shared_ptr<IndexerJob> &job);
+    void onFilesHashed(const Set<uint32_t> &changed);
     bool isIndexed(uint32_t fileId) const;
     SourceInformationMap sources() const;
     DependencyMap dependencies() const;
     bool save(Serializer &out);
     bool restore(Deserializer &in);
 private:
+    void startJob(const SourceInformation &args, unsigned indexerJobFlags);
     void checkFinished();
-    void onFileModified(const Path &);
+    void onFilesModified(const Set<Path> &files);
     void addDependencies(const DependencyMap &hash, Set<uint32_t> &newFiles);
     void addDiagnostics(const DiagnosticsMap &errors, const FixitMap &fixIts);
     void write();
@@ -48,6 +57,12 @@ private:
         EventLoop::instance()->removeTimer(id);
         static_cast<Indexer*>(userData)->onFilesModifiedTimeout();
     }
+    void onUnsavedFilesTimeout();
+    static void onUnsavedFilesTimeout(int id, void *userData)
+    {
+        EventLoop::instance()->removeTimer(id);
+        static_cast<Indexer*>(userData)->onUnsavedFilesTimeout();
+    }
     void onValidateDBJobErrors(const Set<Location> &errors);
 
     enum InitMode {
@@ -60,6 +75,7 @@ private:
     Set<uint32_t> mVisitedFiles;
 
     int mJobCounter;
+    int mDeclarationJobs; // in mJobs
     bool mInMakefile;
 
     mutable Mutex mMutex;
@@ -70,6 +86,10 @@ private:
     Set<uint32_t> mModifiedFiles;
     int mModifiedFilesTimerId;
 
+    UnsavedFilesMap mUnsavedFiles;
+    Set<uint32_t> mModifiedUnsavedFiles;
+    int mUnsavedFilesTimerId;
+
     bool mTimerRunning;
     Timer mTimer;
 
@@ -77,6 +97,7 @@ private:
     FileSystemWatcher mWatcher;
     DependencyMap mDependencies;
     SourceInformationMap mSources;
+    Map<uint32_t, uint64_t> mHashes; // content of the files when they were indexed
 
     Set<Path> mWatchedPaths;
 
@@ -91,6 +112,12 @@ private:
 
     Map<uint32_t, std::shared_ptr<IndexData> > mPendingData;
     Set<uint32_t> mPendingDirtyFiles;
+
+    UsrTable mUsrs;
+    Profiler mProfiler;
+
+    // sources indexed with IndexerJob::Declarations and the files they visited
+    Map<uint32_t, Set<uint32_t> > mDeclarations;
 };
 
 inline bool Indexer::visitFile(uint32_t fileId, const std::shared_ptr<IndexerJob> &job)
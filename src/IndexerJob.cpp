@@ -21,18 +21,19 @@ struct VerboseVisitorUserData {
     IndexerJob *job;
 };
 
-IndexerJob::IndexerJob(const std::shared_ptr<Indexer> &indexer, unsigned flags, const Path &p, const List<ByteArray> &arguments)
+IndexerJob::IndexerJob(const std::shared_ptr<Indexer> &indexer, unsigned flags, const Path &p, const List<ByteArray> &arguments,
+                       const UnsavedFilesMap &unsavedFiles)
     : Job(0, indexer->project()),
       mFlags(flags), mTimeStamp(0), mPath(p), mFileId(Location::insertFile(p)),
-      mArgs(arguments), mIndexer(indexer), mUnit(0), mIndex(0), mDump(false), mParseTime(0),
-      mStarted(false)
+      mArgs(arguments), mUnsavedFiles(unsavedFiles), mIndexer(indexer), mUnit(0), mIndex(0), mDump(false),
+      mIndexAPI(Server::instance()->options() & Server::UseIndexAPI), mParseTime(0), mStarted(false)
 {
 }
 
 IndexerJob::IndexerJob(const QueryMessage &msg, const std::shared_ptr<Project> &project,
                        const Path &input, const List<ByteArray> &arguments)
     : Job(msg, WriteUnfiltered|WriteBuffered, project), mFlags(0), mTimeStamp(0), mPath(input), mFileId(Location::insertFile(input)),
-      mArgs(arguments), mUnit(0), mIndex(0), mDump(true), mParseTime(0), mStarted(false)
+      mArgs(arguments), mUnit(0), mIndex(0), mDump(true), mIndexAPI(false), mParseTime(0), mStarted(false)
 {
 }
 
@@ -45,9 +46,9 @@ void IndexerJob::inclusionVisitor(CXFile includedFile,
     const Location l(includedFile, 0);
 
     const Path path = l.path();
-    job->mData->symbolNames[path].insert(l);
+    job->mData->addSymbolName(path.constData(), path.size(), l);
     const char *fn = path.fileName();
-    job->mData->symbolNames[ByteArray(fn, strlen(fn))].insert(l);
+    job->mData->addSymbolName(fn, strlen(fn), l);
 
     const uint32_t fileId = l.fileId();
     if (!includeLen) {
@@ -64,25 +65,47 @@ void IndexerJob::inclusionVisitor(CXFile includedFile,
     }
 }
 
-static inline void addToSymbolNames(const ByteArray &arg, bool hasTemplates, const Location &location, SymbolNameMap &symbolNames)
+// name has to live in data.arena already
+static inline void addToSymbolNames(const char *name, int length, bool hasTemplates, const Location &location, IndexData &data)
 {
-    symbolNames[arg].insert(location);
+    const IndexData::SymbolName symbolName = { name, length, location };
+    data.symbolNames.append(symbolName);
     if (hasTemplates) {
-        ByteArray copy = arg;
-        const int lt = arg.indexOf('<');
-        if (lt == -1)
+        const char *lt = static_cast<const char*>(memchr(name, '<', length));
+        if (!lt)
             return;
-        const int gt = arg.indexOf('>', lt + 1);
-        if (gt == -1)
+        const char *gt = static_cast<const char*>(memchr(lt + 1, '>', name + length - lt - 1));
+        if (!gt)
             return;
-        if (gt + 1 == arg.size()) {
-            copy.truncate(lt);
-        } else {
-            copy.remove(lt, gt - lt + 1);
-        }
+        const int prefix = lt - name;
+        const int suffix = name + length - gt - 1;
+        char *copy = static_cast<char*>(data.arena.alloc(prefix + suffix + 1, 1));
+        memcpy(copy, name, prefix);
+        memcpy(copy + prefix, gt + 1, suffix);
+        copy[prefix + suffix] = '\0';
+        const IndexData::SymbolName stripped = { copy, prefix + suffix, location };
+        data.symbolNames.append(stripped);
+    }
+}
 
-        symbolNames[copy].insert(location);
+// names[count - 1]::...::names[0] using only the first firstLength bytes of names[0]
+static inline int qualifiedName(Arena &arena, const CXString *names, const int *lengths, int count, int firstLength, const char *&out)
+{
+    int length = firstLength;
+    for (int i=1; i<count; ++i)
+        length += lengths[i] + 2;
+    char *ret = static_cast<char*>(arena.alloc(length + 1, 1));
+    char *pos = ret;
+    for (int i=count - 1; i>0; --i) {
+        memcpy(pos, clang_getCString(names[i]), lengths[i]);
+        pos += lengths[i];
+        *pos++ = ':';
+        *pos++ = ':';
     }
+    memcpy(pos, clang_getCString(names[0]), firstLength);
+    ret[length] = '\0';
+    out = ret;
+    return length;
 }
 
 static const CXCursor nullCursor = clang_getNullCursor();
@@ -112,63 +135,72 @@ static inline bool walk(CXCursorKind kind)
 
 ByteArray IndexerJob::addNamePermutations(const CXCursor &cursor, const Location &location)
 {
-    ByteArray qparam, qnoparam;
+    ++mProfile.counters[Profiler::NamePermutations];
+    // collect the display names from the cursor outwards, then write every
+    // qualified permutation straight into mData->arena
+    enum { MaxDepth = 32 };
+    CXString names[MaxDepth];
+    int lengths[MaxDepth];
+    bool hasTemplates[MaxDepth];
+    int depth = 0;
+    int noParamLength = 0; // names[0] without the argument list
+    bool noParamTemplates = false;
 
     CXCursor cur = cursor;
-    CXCursorKind kind;
-
-    bool first = true;
-    while (true) {
-        if (clang_equalCursors(cur, nullCursor))
+    while (depth < MaxDepth && !clang_equalCursors(cur, nullCursor)) {
+        const CXCursorKind kind = clang_getCursorKind(cur);
+        if (depth && !walk(kind))
             break;
-        kind = clang_getCursorKind(cur);
-
-        if (first) {
-            first = false;
-        } else if (!walk(kind)) {
-            return qparam;
-        }
 
-        CXStringScope displayName(clang_getCursorDisplayName(cur));
-        const char *name = clang_getCString(displayName.string);
-        if (!name || !strlen(name)) {
+        names[depth] = clang_getCursorDisplayName(cur);
+        const char *name = clang_getCString(names[depth]);
+        if (!name || !*name) {
+            clang_disposeString(names[depth]);
             break;
         }
-        const ByteArray qname(name);
-        if (qparam.isEmpty()) {
-            qparam = qname;
-            const int sp = qparam.indexOf('(');
-            if (sp != -1)
-                qnoparam = qparam.left(sp);
-        } else {
-            qparam.prepend(qname + "::");
-            if (!qnoparam.isEmpty())
-                qnoparam.prepend(qname + "::");
+        lengths[depth] = strlen(name);
+        if (!depth) {
+            const char *paren = strchr(name, '(');
+            if (paren) {
+                noParamLength = paren - name;
+                noParamTemplates = memchr(name, '<', noParamLength);
+            }
+        } else if (noParamLength) {
+            noParamTemplates = noParamTemplates || strchr(name, '<');
         }
 
-        assert(!qparam.isEmpty());
-        bool hasTemplates = false;
         switch (kind) {
         case CXCursor_ClassTemplate:
         case CXCursor_Constructor:
         case CXCursor_Destructor:
-            hasTemplates = qnoparam.contains('<');
+            hasTemplates[depth] = noParamTemplates;
             break;
         default:
+            hasTemplates[depth] = false;
             break;
         }
 
-        addToSymbolNames(qparam, hasTemplates, location, mData->symbolNames);
-        if (!qnoparam.isEmpty()) {
-            assert(!qnoparam.isEmpty());
-            addToSymbolNames(qnoparam, hasTemplates, location, mData->symbolNames);
-        }
-
+        ++depth;
         if (!walk(kind))
-            return qparam;
+            break;
         cur = clang_getCursorSemanticParent(cur);
     }
-    return qparam;
+
+    ByteArray ret;
+    for (int i=0; i<depth; ++i) {
+        const char *name;
+        int length = qualifiedName(mData->arena, names, lengths, i + 1, lengths[0], name);
+        addToSymbolNames(name, length, hasTemplates[i], location, *mData);
+        if (i + 1 == depth)
+            ret = ByteArray(name, length);
+        if (noParamLength) {
+            length = qualifiedName(mData->arena, names, lengths, i + 1, noParamLength, name);
+            addToSymbolNames(name, length, hasTemplates[i], location, *mData);
+        }
+    }
+    for (int i=0; i<depth; ++i)
+        clang_disposeString(names[i]);
+    return ret;
 }
 
 static const CXSourceLocation nullLocation = clang_getNullLocation();
@@ -188,7 +220,12 @@ Location IndexerJob::createLocation(const CXCursor &cursor)
 
 Location IndexerJob::createLocation(const CXCursor &cursor, bool *blocked)
 {
-    CXSourceLocation location = clang_getCursorLocation(cursor);
+    return createLocation(clang_getCursorLocation(cursor), blocked);
+}
+
+Location IndexerJob::createLocation(const CXSourceLocation &location, bool *blocked)
+{
+    ++mProfile.counters[Profiler::LocationsCreated];
     Location ret;
     if (blocked)
         *blocked = false;
@@ -197,31 +234,40 @@ Location IndexerJob::createLocation(const CXCursor &cursor, bool *blocked)
         unsigned start;
         clang_getSpellingLocation(location, &file, 0, 0, &start);
         if (file) {
-            ByteArray fileName = RTags::eatString(clang_getFileName(file));
-            uint32_t &fileId = mFileIds[fileName];
-            if (!fileId)
-                fileId = Location::insertFile(Path::resolved(fileName));
-            ret = Location(fileId, start);
-            if (blocked) {
-                PathState &state = mPaths[fileId];
-                if (state == Unset) {
-                    std::shared_ptr<Indexer> indexer = mIndexer.lock();
-                    std::shared_ptr<IndexerJob> job = std::static_pointer_cast<IndexerJob>(shared_from_this());
-                    state = indexer && indexer->visitFile(fileId, job) ? Index : DontIndex;
-                }
-                if (state != Index) {
-                    *blocked = true;
-                    return Location();
-                }
+            const uint32_t id = fileId(file);
+            ret = Location(id, start);
+            if (blocked && pathState(id) != Index) {
+                *blocked = true;
+                return Location();
             }
         }
     }
     return ret;
 }
 
+uint32_t IndexerJob::fileId(CXFile file)
+{
+    uint32_t &fileId = mFileIds[file];
+    if (!fileId)
+        fileId = Location::insertFile(Path::resolved(RTags::eatString(clang_getFileName(file))));
+    return fileId;
+}
+
+IndexerJob::PathState IndexerJob::pathState(uint32_t fileId)
+{
+    PathState &state = mPaths[fileId];
+    if (state == Unset) {
+        std::shared_ptr<Indexer> indexer = mIndexer.lock();
+        std::shared_ptr<IndexerJob> job = std::static_pointer_cast<IndexerJob>(shared_from_this());
+        state = indexer && indexer->visitFile(fileId, job) ? Index : DontIndex;
+    }
+    return state;
+}
+
 CXChildVisitResult IndexerJob::indexVisitor(CXCursor cursor, CXCursor parent, CXClientData data)
 {
     IndexerJob *job = static_cast<IndexerJob*>(data);
+    ++job->mProfile.counters[Profiler::CursorsVisited];
     const CXCursorKind kind = clang_getCursorKind(cursor);
     const RTags::CursorType type = RTags::cursorType(kind);
     if (type == RTags::Other)
@@ -230,22 +276,14 @@ CXChildVisitResult IndexerJob::indexVisitor(CXCursor cursor, CXCursor parent, CX
     bool blocked = false;
     Location loc = job->createLocation(cursor, &blocked);
     if (blocked) {
+        ++job->mProfile.counters[Profiler::CursorsBlocked];
+        // Prune the whole subtree. Members of blocked classes are found
+        // through clang_getCanonicalCursor in handleCursor if this TU
+        // defines them.
         switch (kind) {
-        case CXCursor_FunctionDecl:
-        case CXCursor_CXXMethod:
-        case CXCursor_Destructor:
-        case CXCursor_Constructor:
-        case CXCursor_VarDecl:
-        case CXCursor_FunctionTemplate:
-            job->mHeaderMap[clang_getCursorUSR(cursor)] = job->createLocation(cursor, 0);
-            return CXChildVisit_Continue;
-        case CXCursor_ClassDecl:
-        case CXCursor_StructDecl:
-        case CXCursor_ClassTemplate:
-            job->mHeaderMap[clang_getCursorUSR(cursor)] = job->createLocation(cursor, 0);
-           // fall through
         case CXCursor_Namespace:
         case CXCursor_UnexposedDecl:
+            // extern "C" and namespace blocks can #include files we do index
             return CXChildVisit_Recurse;
         default:
             return CXChildVisit_Continue;
@@ -254,6 +292,9 @@ CXChildVisitResult IndexerJob::indexVisitor(CXCursor cursor, CXCursor parent, CX
         return CXChildVisit_Recurse;
     }
 
+    if (type == RTags::Reference && job->mFlags & Declarations)
+        return CXChildVisit_Recurse;
+
     if (testLog(VerboseDebug)) {
         Log log(VerboseDebug);
         log << cursor;
@@ -294,6 +335,23 @@ static inline bool isImplicit(const CXCursor &cursor)
                                 clang_getCursorLocation(clang_getCursorSemanticParent(cursor)));
 }
 
+// CursorInfo::bestTarget(), for the job's own symbols
+static inline CXCursorKind bestTargetKind(const CursorInfo &info, const IndexData::Symbols &symbols)
+{
+    CXCursorKind best = CursorInfo().kind;
+    int bestRank = -1;
+    for (Set<Location>::const_iterator it = info.targets.begin(); it != info.targets.end(); ++it) {
+        const IndexData::Symbols::const_iterator found = RTags::findCursorInfo(symbols, *it);
+        const CXCursorKind kind = found != symbols.end() ? found->second.kind : CursorInfo().kind;
+        const int rank = CursorInfo::cursorRank(kind);
+        if (rank > bestRank) {
+            bestRank = rank;
+            best = kind;
+        }
+    }
+    return best;
+}
+
 void IndexerJob::handleReference(const CXCursor &cursor, CXCursorKind kind, const Location &loc, const CXCursor &ref)
 {
     const CXCursorKind refKind = clang_getCursorKind(ref);
@@ -343,7 +401,7 @@ void IndexerJob::handleReference(const CXCursor &cursor, CXCursorKind kind, cons
     // The !isCursor is var decls and field decls where we set up a target even
     // if they're not considered references
 
-    if (!RTags::isCursor(info.kind) && (!info.symbolLength || info.bestTarget(mData->symbols).kind == refKind)) {
+    if (!RTags::isCursor(info.kind) && (!info.symbolLength || bestTargetKind(info, mData->symbols) == refKind)) {
         CXSourceRange range = clang_getCursorExtent(cursor);
         unsigned start, end;
         clang_getSpellingLocation(clang_getRangeStart(range), 0, 0, 0, &start);
@@ -355,8 +413,7 @@ void IndexerJob::handleReference(const CXCursor &cursor, CXCursorKind kind, cons
         info.symbolLength = refInfo.symbolLength;
         info.symbolName = refInfo.symbolName;
     }
-    Map<Location, RTags::ReferenceType> &val = mData->references[loc];
-    val[refLoc] = RTags::NormalReference;
+    mData->addReference(loc, refLoc, RTags::NormalReference);
 }
 
 void IndexerJob::addOverriddenCursors(const CXCursor& cursor, const Location& location, List<CursorInfo*>& infos)
@@ -392,27 +449,103 @@ void IndexerJob::handleInclude(const CXCursor &cursor, CXCursorKind kind, const
     assert(kind == CXCursor_InclusionDirective);
     (void)kind;
     CXFile includedFile = clang_getIncludedFile(cursor);
-    if (includedFile) {
-        const Location refLoc(includedFile, 0);
-        if (!refLoc.isNull()) {
-            {
-                ByteArray include = "#include ";
-                const Path path = refLoc.path();
-                mData->symbolNames[(include + path)].insert(location);
-                mData->symbolNames[(include + path.fileName())].insert(location);
-            }
-            CursorInfo &info = mData->symbols[location];
-            info.targets.insert(refLoc);
-            info.kind = cursor.kind;
-            info.isDefinition = false;
-            info.symbolName = "#include " + RTags::eatString(clang_getCursorDisplayName(cursor));
-            info.symbolLength = info.symbolName.size() + 2;
-            // this fails for things like:
-            // # include    <foobar.h>
+    if (includedFile)
+        handleInclude(location, includedFile, RTags::eatString(clang_getCursorDisplayName(cursor)));
+}
+
+void IndexerJob::handleInclude(const Location &location, CXFile includedFile, const ByteArray &name)
+{
+    const Location refLoc(includedFile, 0);
+    if (!refLoc.isNull()) {
+        {
+            ByteArray include = "#include ";
+            const Path path = refLoc.path();
+            const ByteArray full = include + path;
+            mData->addSymbolName(full.constData(), full.size(), location);
+            include += path.fileName();
+            mData->addSymbolName(include.constData(), include.size(), location);
         }
+        CursorInfo &info = mData->symbols[location];
+        info.targets.insert(refLoc);
+        info.kind = CXCursor_InclusionDirective;
+        info.isDefinition = false;
+        info.symbolName = "#include " + name;
+        info.symbolLength = info.symbolName.size() + 2;
+        // this fails for things like:
+        // # include    <foobar.h>
     }
 }
 
+int IndexerJob::abortQuery(CXClientData userData, void *)
+{
+    return static_cast<IndexerJob*>(userData)->isAborted();
+}
+
+// clang hands these back for every location in the file, which lets the
+// callbacks drop references in blocked files without resolving them
+static char sIndexedFile, sBlockedFile;
+CXIdxClientFile IndexerJob::clientFile(CXFile file)
+{
+    return pathState(fileId(file)) == Index ? &sIndexedFile : &sBlockedFile;
+}
+
+CXIdxClientFile IndexerJob::enteredMainFile(CXClientData userData, CXFile mainFile, void *)
+{
+    return static_cast<IndexerJob*>(userData)->clientFile(mainFile);
+}
+
+CXIdxClientFile IndexerJob::ppIncludedFile(CXClientData userData, const CXIdxIncludedFileInfo *info)
+{
+    IndexerJob *job = static_cast<IndexerJob*>(userData);
+    bool blocked;
+    const Location loc = job->createLocation(clang_indexLoc_getCXSourceLocation(info->hashLoc), &blocked);
+    if (!info->file)
+        return 0;
+    if (!blocked && loc.isValid())
+        job->handleInclude(loc, info->file, info->filename);
+    return job->clientFile(info->file);
+}
+
+// The index API has already resolved the USR, definition state, semantic
+// container and referenced entity, so these feed handleCursor and
+// handleReference directly instead of asking libclang for them again.
+void IndexerJob::indexDeclaration(CXClientData userData, const CXIdxDeclInfo *info)
+{
+    IndexerJob *job = static_cast<IndexerJob*>(userData);
+    ++job->mProfile.counters[Profiler::CursorsVisited];
+    const CXCursorKind kind = clang_getCursorKind(info->cursor);
+    if (RTags::cursorType(kind) != RTags::Cursor)
+        return;
+
+    CXIdxClientFile file = 0;
+    clang_indexLoc_getFileLocation(info->loc, &file, 0, 0, 0, 0);
+    if (file == &sBlockedFile) {
+        ++job->mProfile.counters[Profiler::CursorsBlocked];
+        return;
+    }
+    const Location loc = job->createLocation(clang_indexLoc_getCXSourceLocation(info->loc), 0);
+    if (!loc.isNull())
+        job->handleCursor(info->cursor, kind, loc, info);
+}
+
+void IndexerJob::indexEntityReference(CXClientData userData, const CXIdxEntityRefInfo *info)
+{
+    IndexerJob *job = static_cast<IndexerJob*>(userData);
+    if (job->mFlags & Declarations || !info->referencedEntity)
+        return;
+    ++job->mProfile.counters[Profiler::CursorsVisited];
+    CXIdxClientFile file = 0;
+    clang_indexLoc_getFileLocation(info->loc, &file, 0, 0, 0, 0);
+    if (file == &sBlockedFile) {
+        ++job->mProfile.counters[Profiler::CursorsBlocked];
+        return;
+    }
+    const Location loc = job->createLocation(clang_indexLoc_getCXSourceLocation(info->loc), 0);
+    if (loc.isNull())
+        return;
+    job->handleReference(info->cursor, clang_getCursorKind(info->cursor), loc, info->referencedEntity->cursor);
+}
+
 static inline bool isInline(const CXCursor &cursor)
 {
     switch (clang_getCursorKind(clang_getCursorLexicalParent(cursor))) {
@@ -425,7 +558,8 @@ static inline bool isInline(const CXCursor &cursor)
     }
 }
 
-void IndexerJob::handleCursor(const CXCursor &cursor, CXCursorKind kind, const Location &location)
+void IndexerJob::handleCursor(const CXCursor &cursor, CXCursorKind kind, const Location &location,
+                              const CXIdxDeclInfo *decl)
 {
     CursorInfo &info = mData->symbols[location];
     RTags::ReferenceType referenceType = RTags::NoReference;
@@ -437,7 +571,7 @@ void IndexerJob::handleCursor(const CXCursor &cursor, CXCursorKind kind, const L
         info.start = start;
         info.end = end;
 
-        info.isDefinition = clang_isCursorDefinition(cursor);
+        info.isDefinition = decl ? decl->isDefinition : clang_isCursorDefinition(cursor);
         info.kind = kind;
         CXStringScope name = clang_getCursorSpelling(cursor);
         const char *cstr = clang_getCString(name.string);
@@ -462,7 +596,10 @@ void IndexerJob::handleCursor(const CXCursor &cursor, CXCursorKind kind, const L
         case CXCursor_Constructor:
         case CXCursor_Destructor: {
             referenceType = RTags::LinkedReference;
-            Location parentLocation = createLocation(clang_getCursorSemanticParent(cursor));
+            const CXCursor parent = (decl && decl->semanticContainer
+                                     ? decl->semanticContainer->cursor
+                                     : clang_getCursorSemanticParent(cursor));
+            Location parentLocation = createLocation(parent);
             // consider doing this for only declaration/inline definition since
             // declaration and definition should know of one another
             if (parentLocation.isValid()) {
@@ -504,10 +641,12 @@ void IndexerJob::handleCursor(const CXCursor &cursor, CXCursorKind kind, const L
                 case CXCursor_StructDecl:
                 case CXCursor_FunctionDecl:
                 case CXCursor_VarDecl: {
-                    const Str usr(clang_getCursorUSR(cursor));
-                    if (usr.length()) {
-                        refLoc = mHeaderMap.value(usr);
-                    }
+                    const CXCursor canonical = clang_getCanonicalCursor(cursor);
+                    if (!clang_equalCursors(canonical, cursor))
+                        refLoc = createLocation(canonical, 0);
+                    // declarations in units that can't see this definition
+                    // are linked to it in Indexer::write
+                    addUsr(cursor, decl, UsrTable::Definition, location);
                     break; }
                 default:
                     assert(0);
@@ -518,20 +657,36 @@ void IndexerJob::handleCursor(const CXCursor &cursor, CXCursorKind kind, const L
                 if (!clang_equalCursors(nullCursor, other)) {
                     refLoc = createLocation(other, 0);
                     assert(!clang_equalCursors(cursor, other));
+                } else {
+                    // defined in another translation unit
+                    addUsr(cursor, decl, UsrTable::Declaration, location);
                 }
             }
             if (refLoc.isValid()) {
-                Map<Location, RTags::ReferenceType> &val = mData->references[location];
-                val[refLoc] = referenceType;
+                mData->addReference(location, refLoc, referenceType);
                 info.targets.insert(refLoc);
             }
         }
     }
 }
 
+void IndexerJob::addUsr(const CXCursor &cursor, const CXIdxDeclInfo *decl, UsrTable::Kind kind, const Location &location)
+{
+    UsrTable::Entry entry = { 0, kind, location };
+    if (decl && decl->entityInfo && decl->entityInfo->USR) {
+        entry.usr = UsrTable::hash(decl->entityInfo->USR, strlen(decl->entityInfo->USR));
+    } else {
+        const Str usr(clang_getCursorUSR(cursor));
+        if (!usr.length())
+            return;
+        entry.usr = UsrTable::hash(usr.data(), usr.length());
+    }
+    mData->usrs.append(entry);
+}
+
 void IndexerJob::parse()
 {
-    mHeaderMap.clear();
+    Profiler::Scope profile(mProfile.phases[Profiler::Parse]);
     if (!mIndex) {
         mIndex = clang_createIndex(0, 1);
         if (!mIndex) {
@@ -563,10 +718,37 @@ void IndexerJob::parse()
 
     mClangLine += mPath;
 
+    List<CXUnsavedFile> unsaved(mUnsavedFiles.size());
+    int unsavedCount = 0;
+    for (UnsavedFilesMap::const_iterator it = mUnsavedFiles.begin(); it != mUnsavedFiles.end(); ++it) {
+        CXUnsavedFile &file = unsaved[unsavedCount++];
+        file.Filename = it->first.constData();
+        file.Contents = it->second.constData();
+        file.Length = it->second.size();
+    }
+
+    unsigned flags = CXTranslationUnit_Incomplete | CXTranslationUnit_DetailedPreprocessingRecord;
+    if (mFlags & Declarations)
+        flags |= CXTranslationUnit_SkipFunctionBodies;
+
     const time_t now = time(0);
-    mUnit = clang_parseTranslationUnit(mIndex, mPath.constData(),
-                                       clangArgs.data(), idx, 0, 0,
-                                       CXTranslationUnit_Incomplete | CXTranslationUnit_DetailedPreprocessingRecord);
+    if (mIndexAPI) {
+        IndexerCallbacks callbacks;
+        memset(&callbacks, 0, sizeof(callbacks));
+        callbacks.abortQuery = abortQuery;
+        callbacks.enteredMainFile = enteredMainFile;
+        callbacks.ppIncludedFile = ppIncludedFile;
+        callbacks.indexDeclaration = indexDeclaration;
+        callbacks.indexEntityReference = indexEntityReference;
+        CXIndexAction action = clang_IndexAction_create(mIndex);
+        clang_indexSourceFile(action, this, &callbacks, sizeof(callbacks), CXIndexOpt_IndexFunctionLocalSymbols,
+                              mPath.constData(), clangArgs.data(), idx, unsaved.data(), unsavedCount,
+                              &mUnit, flags);
+        clang_IndexAction_dispose(action);
+    } else {
+        mUnit = clang_parseTranslationUnit(mIndex, mPath.constData(),
+                                           clangArgs.data(), idx, unsaved.data(), unsavedCount, flags);
+    }
     warning() << "loading unit " << mClangLine << " " << (mUnit != 0);
     if (!mUnit) {
         error() << "got failure" << mClangLine;
@@ -578,6 +760,7 @@ void IndexerJob::parse()
 
 void IndexerJob::diagnose()
 {
+    Profiler::Scope profile(mProfile.phases[Profiler::Diagnose]);
     if (!mUnit)
         return;
     const unsigned diagnosticCount = clang_getNumDiagnostics(mUnit);
@@ -649,11 +832,17 @@ void IndexerJob::visit()
 {
     if (!mUnit)
         return;
-    clang_getInclusions(mUnit, inclusionVisitor, this);
-    if (isAborted())
+    {
+        Profiler::Scope profile(mProfile.phases[Profiler::Inclusions]);
+        clang_getInclusions(mUnit, inclusionVisitor, this);
+    }
+    if (isAborted() || mIndexAPI) // the index API visited everything while parsing
         return;
 
-    clang_visitChildren(clang_getTranslationUnitCursor(mUnit), indexVisitor, this);
+    {
+        Profiler::Scope profile(mProfile.phases[Profiler::Visit]);
+        clang_visitChildren(clang_getTranslationUnitCursor(mUnit), indexVisitor, this);
+    }
     if (isAborted())
         return;
     if (testLog(VerboseDebug)) {
@@ -673,6 +862,20 @@ void IndexerJob::visit()
     }
 }
 
+// sorts by location and target, keeping only the last reference added for each pair
+static inline void sortReferences(List<IndexData::Reference> &references)
+{
+    std::stable_sort(references.begin(), references.end());
+    int out = 0;
+    const int count = references.size();
+    for (int i=0; i<count; ++i) {
+        if (i + 1 < count && !(references.at(i) < references.at(i + 1)))
+            continue;
+        references[out++] = references.at(i);
+    }
+    references.resize(out);
+}
+
 void IndexerJob::execute()
 {
     if (isAborted())
@@ -692,16 +895,27 @@ void IndexerJob::execute()
         typedef void (IndexerJob::*Function)();
         Function functions[] = { &IndexerJob::parse, &IndexerJob::diagnose, &IndexerJob::visit };
         for (unsigned i=0; i<sizeof(functions) / sizeof(Function); ++i) {
+            if (functions[i] == &IndexerJob::diagnose && mFlags & Declarations)
+                continue; // without function bodies the diagnostics are incomplete
             (this->*functions[i])();
             if (isAborted())
                 break;
         }
 
-        mHeaderMap.clear();
-        mData->message = ByteArray::snprintf<1024>("%s (%s) in %sms. (%d syms, %d symNames, %d refs, %d deps)%s",
-                                                   mPath.constData(), mUnit ? "success" : "error", ByteArray::number(mTimer.elapsed()).constData(),
+        if (!isAborted())
+            hashFiles();
+        std::sort(mData->symbolNames.begin(), mData->symbolNames.end());
+        mData->symbolNames.erase(std::unique(mData->symbolNames.begin(), mData->symbolNames.end()), mData->symbolNames.end());
+        sortReferences(mData->references);
+        mProfile.counters[Profiler::IndexDataBytes] = (mData->arena.size()
+                                                       + (mData->symbolNames.capacity() * sizeof(IndexData::SymbolName))
+                                                       + (mData->references.capacity() * sizeof(IndexData::Reference)));
+        mData->message = ByteArray::snprintf<1024>("%s (%s%s) in %sms. (%d syms, %d symNames, %d refs, %d deps)%s",
+                                                   mPath.constData(), mUnit ? "success" : "error", mIndexAPI ? ", index api" : "",
+                                                   ByteArray::number(mTimer.elapsed()).constData(),
                                                    mData->symbols.size(), mData->symbolNames.size(), mData->references.size(), mData->dependencies.size(),
-                                                   mFlags & Dirty ? " (dirty)" : "");
+                                                   mFlags & Unsaved ? " (unsaved)" : mFlags & Dirty ? " (dirty)"
+                                                   : mFlags & Declarations ? " (declarations)" : mFlags & References ? " (references)" : "");
     }
     if (mUnit) {
         clang_disposeTranslationUnit(mUnit);
@@ -718,6 +932,29 @@ void IndexerJob::execute()
     }
 }
 
+void IndexerJob::hashFiles()
+{
+    for (Map<uint32_t, PathState>::const_iterator it = mPaths.begin(); it != mPaths.end(); ++it) {
+        if (it->second != Index)
+            continue;
+        const Path path = Location::path(it->first);
+        uint64_t &hash = mData->hashes[it->first];
+        // if it came from the editor or changed after we parsed it the hash
+        // wouldn't describe what we indexed, leave it unknown
+        if (mParseTime && !mUnsavedFiles.contains(path) && path.isFile() && path.lastModified() < mParseTime)
+            hash = RTags::hashFile(path);
+    }
+}
+
+static inline bool isReference(const List<IndexData::Reference> &references, const Location &loc)
+{
+    for (List<IndexData::Reference>::const_iterator it = references.begin(); it != references.end(); ++it) {
+        if (it->location == loc)
+            return true;
+    }
+    return false;
+}
+
 CXChildVisitResult IndexerJob::verboseVisitor(CXCursor cursor, CXCursor, CXClientData userData)
 {
     VerboseVisitorUserData *u = reinterpret_cast<VerboseVisitorUserData*>(userData);
@@ -736,7 +973,7 @@ CXChildVisitResult IndexerJob::verboseVisitor(CXCursor cursor, CXCursor, CXClien
         }
 
         if (loc.fileId() && u->job->mPaths.value(loc.fileId()) == IndexerJob::Index) {
-            if (u->job->mData->references.contains(loc)) {
+            if (isReference(u->job->mData->references, loc)) {
                 u->out += " used as reference\n";
             } else if (u->job->mData->symbols.contains(loc)) {
                 u->out += " used as cursor\n";
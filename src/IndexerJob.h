@@ -1,19 +1,73 @@
 #ifndef IndexerJob_h
 #define IndexerJob_h
 
+#include "Arena.h"
 #include "Indexer.h"
 #include "RTags.h"
 #include "Job.h"
 #include "Str.h"
 #include "ThreadPool.h"
+#include "UsrTable.h"
 #include "Mutex.h"
+#include "Profiler.h"
 #include <clang-c/Index.h>
 
+// Everything a job produces. The containers allocate from arena, which
+// releases all of it in one go when the data is destroyed after
+// Indexer::write has copied it into the project.
 struct IndexData {
-    ReferenceMap references;
-    SymbolMap symbols;
-    SymbolNameMap symbolNames;
+    IndexData()
+        : symbols(ArenaAllocator<std::pair<const Location, CursorInfo> >(&arena))
+    {}
+
+    struct SymbolName {
+        const char *name; // lives in IndexData::arena
+        int length;
+        Location location;
+
+        bool operator==(const SymbolName &other) const
+        {
+            return length == other.length && location == other.location && !memcmp(name, other.name, length);
+        }
+        bool operator<(const SymbolName &other) const
+        {
+            const int cmp = memcmp(name, other.name, std::min(length, other.length));
+            if (cmp)
+                return cmp < 0;
+            if (length != other.length)
+                return length < other.length;
+            return location < other.location;
+        }
+    };
+    void addSymbolName(const char *name, int length, const Location &location)
+    {
+        const SymbolName symbolName = { arena.strdup(name, length), length, location };
+        symbolNames.append(symbolName);
+    }
+
+    struct Reference {
+        Location location, target;
+        RTags::ReferenceType type;
+
+        bool operator<(const Reference &other) const
+        {
+            return location < other.location || (location == other.location && target < other.target);
+        }
+    };
+    void addReference(const Location &location, const Location &target, RTags::ReferenceType type)
+    {
+        const Reference reference = { location, target, type };
+        references.append(reference);
+    }
+
+    Arena arena; // declared first so it's destroyed last
+    typedef Map<Location, CursorInfo, ArenaAllocator<std::pair<const Location, CursorInfo> > > Symbols;
+    Symbols symbols;
+    List<Reference> references; // sorted once the job is done, the last one for a location/target pair wins
+    List<SymbolName> symbolNames; // sorted and unique once the job is done
     DependencyMap dependencies;
+    List<UsrTable::Entry> usrs; // linked across translation units in Indexer::write
+    Map<uint32_t, uint64_t> hashes; // content of the files this job indexed, 0 if unknown
     FixitMap fixIts;
     DiagnosticsMap diagnostics;
     ByteArray message;
@@ -25,14 +79,19 @@ public:
     enum Flag {
         Makefile = 0x1,
         Dirty = 0x02,
-        Priorities = Dirty|Makefile
+        Unsaved = 0x04,
+        Priorities = Unsaved|Dirty|Makefile,
+        Declarations = 0x08, // first tier, skips function bodies and references
+        References = 0x10 // second tier, fills in what Declarations skipped
     };
     IndexerJob(const std::shared_ptr<Indexer> &indexer, unsigned flags,
-               const Path &input, const List<ByteArray> &arguments);
+               const Path &input, const List<ByteArray> &arguments,
+               const UnsavedFilesMap &unsavedFiles = UnsavedFilesMap());
     IndexerJob(const QueryMessage &msg, const std::shared_ptr<Project> &project,
                const Path &input, const List<ByteArray> &arguments);
 
     int priority() const { return mFlags & Priorities; }
+    unsigned flags() const { return mFlags; }
     std::shared_ptr<IndexData> data() const { return mData; }
     uint32_t fileId() const { return mFileId; }
     Path path() const { return mPath; }
@@ -41,14 +100,17 @@ public:
     bool abortIfStarted();
     std::shared_ptr<Indexer> indexer() { MutexLocker lock(&mMutex); return mIndexer.lock(); }
     time_t parseTime() const { return mParseTime; }
+    const Profiler::Sample &profile() const { return mProfile; }
 private:
     void parse();
     void visit();
     void diagnose();
+    void hashFiles();
 
     virtual void execute();
 
     Location createLocation(const CXCursor &cursor, bool *blocked);
+    Location createLocation(const CXSourceLocation &location, bool *blocked);
     static Location createLocation(const CXCursor &cursor);
     ByteArray addNamePermutations(const CXCursor &cursor, const Location &location);
     static CXChildVisitResult indexVisitor(CXCursor cursor, CXCursor parent, CXClientData client_data);
@@ -58,10 +120,19 @@ private:
     static void inclusionVisitor(CXFile included_file, CXSourceLocation *include_stack,
                                  unsigned include_len, CXClientData client_data);
 
-    void handleCursor(const CXCursor &cursor, CXCursorKind kind, const Location &location);
+    // clang_indexSourceFile callbacks
+    static int abortQuery(CXClientData client_data, void *reserved);
+    static CXIdxClientFile enteredMainFile(CXClientData client_data, CXFile mainFile, void *reserved);
+    static CXIdxClientFile ppIncludedFile(CXClientData client_data, const CXIdxIncludedFileInfo *info);
+    static void indexDeclaration(CXClientData client_data, const CXIdxDeclInfo *info);
+    static void indexEntityReference(CXClientData client_data, const CXIdxEntityRefInfo *info);
+
+    void handleCursor(const CXCursor &cursor, CXCursorKind kind, const Location &location,
+                      const CXIdxDeclInfo *decl = 0);
     void handleReference(const CXCursor &cursor, CXCursorKind kind, const Location &loc, const CXCursor &reference);
     void handleInclude(const CXCursor &cursor, CXCursorKind kind, const Location &location);
-    Location findByUSR(const CXCursor &cursor, CXCursorKind kind, const Location &loc) const;
+    void handleInclude(const Location &location, CXFile includedFile, const ByteArray &name);
+    void addUsr(const CXCursor &cursor, const CXIdxDeclInfo *decl, UsrTable::Kind kind, const Location &location);
     void addOverriddenCursors(const CXCursor& cursor, const Location& location, List<CursorInfo*>& infos);
 
     unsigned mFlags;
@@ -73,11 +144,14 @@ private:
         DontIndex
     };
     Map<uint32_t, PathState> mPaths;
+    uint32_t fileId(CXFile file);
+    PathState pathState(uint32_t fileId);
+    CXIdxClientFile clientFile(CXFile file);
 
-    Map<Str, Location> mHeaderMap;
     const Path mPath;
     const uint32_t mFileId;
     const List<ByteArray> mArgs;
+    const UnsavedFilesMap mUnsavedFiles;
 
     Mutex mMutex;
     std::weak_ptr<Indexer> mIndexer;
@@ -85,7 +159,7 @@ private:
     CXTranslationUnit mUnit;
     CXIndex mIndex;
 
-    Map<ByteArray, uint32_t> mFileIds;
+    Map<CXFile, uint32_t> mFileIds; // CXFiles are unique per translation unit
 
     ByteArray mClangLine;
 
@@ -93,8 +167,10 @@ private:
     std::shared_ptr<IndexData> mData;
 
     bool mDump;
+    const bool mIndexAPI;
 
     time_t mParseTime;
+    Profiler::Sample mProfile;
 
     bool mStarted;
 };
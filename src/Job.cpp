@@ -5,13 +5,15 @@
 #include "CursorInfo.h"
 #include "RegExp.h"
 #include "QueryMessage.h"
+#include "Project.h"
 
 // static int count = 0;
 // static int active = 0;
 
 Job::Job(const QueryMessage &query, unsigned jobFlags, const std::shared_ptr<Project> &proj)
     : mId(-1), mJobFlags(jobFlags), mQueryFlags(query.flags()), mProject(proj), mPathFilters(0),
-      mPathFiltersRegExp(0), mMax(query.max())
+      mPathFiltersRegExp(0), mMax(query.max()), mLocations(-1, QueryMessage::keyFlags(query.flags())),
+      mPendingOutput(0)
 {
     const List<ByteArray> &pathFilters = query.pathFilters();
     if (!pathFilters.isEmpty()) {
@@ -29,7 +31,8 @@ Job::Job(const QueryMessage &query, unsigned jobFlags, const std::shared_ptr<Pro
 }
 
 Job::Job(unsigned jobFlags, const std::shared_ptr<Project> &proj)
-    : mId(-1), mJobFlags(jobFlags), mQueryFlags(0), mProject(proj), mPathFilters(0), mPathFiltersRegExp(0), mMax(-1)
+    : mId(-1), mJobFlags(jobFlags), mQueryFlags(0), mProject(proj), mPathFilters(0), mPathFiltersRegExp(0), mMax(-1),
+      mPendingOutput(0)
 {
 }
 
@@ -82,7 +85,7 @@ bool Job::writeRaw(const ByteArray &out, unsigned flags)
     if (mJobFlags & WriteBuffered) {
         enum { BufSize = 16384 };
         if (mBuffer.size() + out.size() + 1 > BufSize) {
-            EventLoop::instance()->postEvent(Server::instance(), new JobOutputEvent(shared_from_this(), mBuffer, false));
+            postOutput(mBuffer);
             mBuffer.clear();
             mBuffer.reserve(BufSize);
         }
@@ -90,9 +93,71 @@ bool Job::writeRaw(const ByteArray &out, unsigned flags)
             mBuffer.append('\n');
         mBuffer.append(out);
     } else {
-        EventLoop::instance()->postEvent(Server::instance(), new JobOutputEvent(shared_from_this(), out, false));
+        postOutput(out);
+    }
+    return !isAborted();
+}
+
+void Job::postOutput(const ByteArray &out, int messageId)
+{
+    EventLoop::instance()->postEvent(Server::instance(), new JobOutputEvent(shared_from_this(), out, false, messageId));
+    if (mId == -1) // no connection, nobody will tell us about it
+        return;
+    MutexLocker lock(&mOutputMutex);
+    mPendingOutput += out.size();
+    // With project locks held the main thread might be waiting for us, the
+    // output is held back the next time we post without them instead
+    if (mPendingOutput > HighWaterMark && !heldScopes()) {
+        while (mPendingOutput > LowWaterMark && !isAborted())
+            mOutputCondition.wait(&mOutputMutex);
+    }
+}
+
+void Job::outputWritten(int bytes)
+{
+    MutexLocker lock(&mOutputMutex);
+    mPendingOutput -= bytes;
+    if (mPendingOutput <= LowWaterMark)
+        mOutputCondition.wakeAll();
+}
+
+void Job::abort()
+{
+    AbortInterface::abort();
+    MutexLocker lock(&mOutputMutex);
+    mOutputCondition.wakeAll();
+}
+
+bool Job::writeLocation(const Location &location, uint32_t kind)
+{
+    if (!(mQueryFlags & QueryMessage::Binary) || mJobFlags & QuoteOutput)
+        return write(location.key(keyFlags()));
+    if (!(mJobFlags & WriteUnfiltered) && !filter(location.path()))
+        return true;
+    if (mMax > 0)
+        --mMax;
+    enum { MaxEntries = 4096 };
+    mLocations.add(location, kind);
+    if (mLocations.count() >= MaxEntries)
+        flushLocations();
+    return !isAborted();
+}
+
+void Job::flushLocations()
+{
+    if (!mLocations.isEmpty()) {
+        postOutput(mLocations.encode(), LocationsMessage::MessageId);
+        mLocations.clear();
+    }
+}
+
+void Job::flush()
+{
+    flushLocations();
+    if (!mBuffer.isEmpty()) {
+        postOutput(mBuffer);
+        mBuffer.clear();
     }
-    return true;
 }
 
 bool Job::write(const Location &location, const CursorInfo &ci, unsigned flags)
@@ -111,6 +176,7 @@ unsigned Job::keyFlags() const
 void Job::run()
 {
     execute();
+    flushLocations();
     if (mId != -1)
         EventLoop::instance()->postEvent(Server::instance(), new JobOutputEvent(shared_from_this(), mBuffer, true));
 }
@@ -9,6 +9,9 @@
 #include "SignalSlot.h"
 #include "Server.h"
 #include "RegExp.h"
+#include "LocationsMessage.h"
+#include "ResponseMessage.h"
+#include "WaitCondition.h"
 #include <memory>
 #include "RTagsClang.h"
 
@@ -41,6 +44,8 @@ public:
     };
     bool write(const ByteArray &out, unsigned flags = NoWriteFlags);
     bool write(const Location &location, const CursorInfo &info, unsigned flags = NoWriteFlags);
+    // Location::key() in text mode, a packed record for QueryMessage::Binary
+    bool writeLocation(const Location &location, uint32_t kind = 0);
     template <int StaticBufSize> bool write(unsigned flags, const char *format, ...);
     template <int StaticBufSize> bool write(const char *format, ...);
     unsigned jobFlags() const { return mJobFlags; }
@@ -54,8 +59,26 @@ public:
     void resetProject() { mProject.reset(); }
     virtual void run();
     virtual void execute() = 0;
+    virtual void abort();
+    // sends everything buffered so far without finishing the job
+    void flush();
+    void setBatchIndex(int index) { mLocations = LocationsMessage(index, mLocations.keyFlags()); }
+
+    // Output is posted to the Server as it's produced. Once more than
+    // HighWaterMark bytes of it haven't made it to the client yet, write()
+    // blocks until the Server reports that we're below LowWaterMark again
+    // or the job is aborted because the connection went away. It doesn't
+    // block while the job holds project locks, see heldScopes().
+    enum {
+        HighWaterMark = 1024 * 1024,
+        LowWaterMark = 256 * 1024
+    };
+    void outputWritten(int bytes); // main thread
+protected:
+    void postOutput(const ByteArray &out, int messageId = ResponseMessage::MessageId);
 private:
     bool writeRaw(const ByteArray &out, unsigned flags);
+    void flushLocations();
     int mId;
     unsigned mJobFlags;
     unsigned mQueryFlags;
@@ -65,6 +88,11 @@ private:
     List<RegExp> *mPathFiltersRegExp;
     int mMax;
     ByteArray mBuffer;
+    LocationsMessage mLocations;
+
+    Mutex mOutputMutex;
+    WaitCondition mOutputCondition;
+    int mPendingOutput;
 };
 
 template <int StaticBufSize>
@@ -109,14 +137,16 @@ class JobOutputEvent : public Event
 {
 public:
     enum { Type = 2 };
-    JobOutputEvent(const std::shared_ptr<Job> &j, const ByteArray &o, bool f)
-        : Event(Type), job(j), out(o), finish(f), id(j->id())
+    JobOutputEvent(const std::shared_ptr<Job> &j, const ByteArray &o, bool f,
+                   int m = ResponseMessage::MessageId)
+        : Event(Type), job(j), out(o), finish(f), id(j->id()), messageId(m)
     {}
 
     std::weak_ptr<Job> job;
     const ByteArray out;
     const bool finish;
     const int id;
+    const int messageId;
 };
 
 #endif
@@ -49,7 +49,8 @@ void ListSymbolsJob::execute()
                 }
                 if (ok) {
                     if (elispList) {
-                        write(entry);
+                        if (!write(entry))
+                            return;
                     } else {
                         out.append(entry);
                     }
@@ -72,7 +73,8 @@ void ListSymbolsJob::execute()
             for (Map<Location, bool>::const_iterator i = locations.begin(); i != locations.end(); ++i) {
                 if (!i->second && (!hasFilter || filter(i->first.path()))) {
                     if (elispList) {
-                        write(entry);
+                        if (!write(entry))
+                            return;
                     } else {
                         out.append(entry);
                     }
@@ -93,7 +95,8 @@ void ListSymbolsJob::execute()
         }
         const int count = out.size();
         for (int i=0; i<count; ++i) {
-            write(out.at(i));
+            if (!write(out.at(i)))
+                return;
         }
     }
 }
@@ -10,6 +10,7 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <unistd.h>
 
@@ -17,20 +18,20 @@ class DelayedWriteEvent : public Event
 {
 public:
     enum { Type = 1 };
-    DelayedWriteEvent(const ByteArray& d)
+    DelayedWriteEvent(const List<LocalClient::Buffer> &d)
         : Event(Type), data(d)
     {}
 
-    const ByteArray data;
+    const List<LocalClient::Buffer> data;
 };
 
 LocalClient::LocalClient()
-    : mFd(-1), mBufferIdx(0), mReadBufferPos(0)
+    : mFd(-1), mBufferIdx(0), mReadBufferPos(0), mReadBufferEnd(0)
 {
 }
 
 LocalClient::LocalClient(int fd)
-    : mFd(fd), mBufferIdx(0), mReadBufferPos(0)
+    : mFd(fd), mBufferIdx(0), mReadBufferPos(0), mReadBufferEnd(0)
 {
     int flags;
     eintrwrap(flags, fcntl(mFd, F_GETFL, 0));
@@ -65,6 +66,7 @@ bool LocalClient::connect(const Path& path, int maxTime)
             return false;
         }
         int ret;
+        eintrwrap(ret, fcntl(mFd, F_SETFD, FD_CLOEXEC));
         eintrwrap(ret, ::connect(mFd, (struct sockaddr *)&address, sizeof(struct sockaddr_un)));
         if (!ret) {
 #ifdef HAVE_NOSIGPIPE
@@ -98,9 +100,9 @@ bool LocalClient::connect(const Path& path, int maxTime)
 void LocalClient::disconnect()
 {
     if (mFd != -1) {
+        EventLoop::instance()->removeFileDescriptor(mFd);
         int ret;
         eintrwrap(ret, ::close(mFd));
-        EventLoop::instance()->removeFileDescriptor(mFd);
         mFd = -1;
         disconnected()();
     }
@@ -117,12 +119,8 @@ void LocalClient::dataCallback(int, unsigned int flags, void* userData)
 
 ByteArray LocalClient::readAll()
 {
-    ByteArray buf;
-    std::swap(buf, mReadBuffer);
-    if (mReadBufferPos) {
-        buf.remove(0, mReadBufferPos);
-        mReadBufferPos = 0;
-    }
+    const ByteArray buf(peek(), bytesAvailable());
+    mReadBufferPos = mReadBufferEnd = 0;
     return buf;
 }
 
@@ -130,44 +128,83 @@ int LocalClient::read(char *buf, int size)
 {
     size = std::min(bytesAvailable(), size);
     if (size) {
-        memcpy(buf, mReadBuffer.data() + mReadBufferPos, size);
-        mReadBufferPos += size;
-        if (mReadBuffer.size() == mReadBufferPos) {
-            mReadBuffer.clear();
-            mReadBufferPos = 0;
-        }
+        memcpy(buf, peek(), size);
+        skip(size);
     }
     return size;
 }
 
+void LocalClient::skip(int bytes)
+{
+    assert(bytes <= bytesAvailable());
+    mReadBufferPos += bytes;
+    if (mReadBufferPos == mReadBufferEnd)
+        mReadBufferPos = mReadBufferEnd = 0;
+}
+
 bool LocalClient::write(const ByteArray& data)
+{
+    return write(Buffer(new ByteArray(data)));
+}
+
+bool LocalClient::write(const Buffer &buffer)
+{
+    return write(List<Buffer>(1, buffer));
+}
+
+bool LocalClient::write(const List<Buffer> &buffers)
 {
     if (pthread_equal(pthread_self(), EventLoop::instance()->thread())) {
         if (mBuffers.empty())
             EventLoop::instance()->addFileDescriptor(mFd, EventLoop::Read | EventLoop::Write, dataCallback, this);
-        mBuffers.push_back(data);
+        mBuffers.insert(mBuffers.end(), buffers.begin(), buffers.end());
         return writeMore();
     } else {
-        EventLoop::instance()->postEvent(this, new DelayedWriteEvent(data));
+        EventLoop::instance()->postEvent(this, new DelayedWriteEvent(buffers));
         return true;
     }
 }
 
 void LocalClient::readMore()
 {
-    enum { BufSize = 1024, MaxBufferSize = 1024 * 1024 * 16 };
+    enum { MinRead = 1024 * 64, MaxBufferSize = 1024 * 1024 * 16 };
 
 #ifdef HAVE_NOSIGNAL
     const int recvflags = MSG_NOSIGNAL;
 #else
     const int recvflags = 0;
 #endif
-    char buf[BufSize];
     int read = 0;
     bool wasDisconnected = false;
     for (;;) {
+        // recv straight into the buffer. Consumed data is only moved out of
+        // the way when we're short on room, the buffer itself is kept
+        if (mReadBuffer.size() - mReadBufferEnd < MinRead) {
+            if (mReadBufferPos) {
+                memmove(mReadBuffer.data(), peek(), bytesAvailable());
+                mReadBufferEnd -= mReadBufferPos;
+                mReadBufferPos = 0;
+            }
+            if (mReadBuffer.size() - mReadBufferEnd < MinRead) {
+                if (mReadBuffer.size() >= MaxBufferSize) {
+                    if (read) {
+                        // let the consumer catch up before reading more
+                        read = 0;
+                        mDataAvailable();
+                        if (mFd == -1)
+                            return;
+                        continue;
+                    }
+                    error("Buffer exhausted (%d), dropping on the floor", mReadBufferEnd);
+                    mReadBufferPos = mReadBufferEnd = 0;
+                } else {
+                    mReadBuffer.resize(std::min<int>(MaxBufferSize, std::max(mReadBuffer.size() * 2,
+                                                                             mReadBufferEnd + MinRead)));
+                }
+            }
+        }
         int r;
-        eintrwrap(r, ::recv(mFd, buf, BufSize, recvflags));
+        eintrwrap(r, ::recv(mFd, mReadBuffer.data() + mReadBufferEnd, mReadBuffer.size() - mReadBufferEnd, recvflags));
 
         if (r == -1) {
             break;
@@ -176,20 +213,10 @@ void LocalClient::readMore()
             break;
         }
         read += r;
-        mReadBuffer.resize(r + mReadBuffer.size());
-        memcpy(mReadBuffer.data() + mReadBuffer.size() - r, buf, r);
-        if (mReadBuffer.size() + r >= MaxBufferSize) {
-            if (mReadBuffer.size() + r - mReadBufferPos < MaxBufferSize) {
-                mReadBuffer.remove(0, mReadBufferPos);
-                mReadBufferPos = 0;
-            } else {
-                error("Buffer exhausted (%d), dropping on the floor", mReadBuffer.size());
-                mReadBuffer.clear();
-            }
-        }
+        mReadBufferEnd += r;
     }
 
-    if (read && !mReadBuffer.isEmpty())
+    if (read && bytesAvailable())
         mDataAvailable();
     if (wasDisconnected)
         disconnect();
@@ -197,6 +224,7 @@ void LocalClient::readMore()
 
 bool LocalClient::writeMore()
 {
+    enum { MaxIov = 64 };
     bool ret = true;
     int written = 0;
 #ifdef HAVE_NOSIGNAL
@@ -204,14 +232,28 @@ bool LocalClient::writeMore()
 #else
     const int sendflags = 0;
 #endif
+    iovec iov[MaxIov];
     for (;;) {
         if (mBuffers.empty()) {
             EventLoop::instance()->removeFileDescriptor(mFd, EventLoop::Write);
             break;
         }
-        const ByteArray& front = mBuffers.front();
+        // hand the kernel as many queued buffers as we can in one go, the
+        // first one might be partially written already
+        int count = 0;
+        for (std::deque<Buffer>::const_iterator it = mBuffers.begin(); it != mBuffers.end() && count < MaxIov; ++it) {
+            const ByteArray &buffer = **it;
+            const int offset = count ? 0 : mBufferIdx;
+            iov[count].iov_base = const_cast<char*>(buffer.constData()) + offset;
+            iov[count].iov_len = buffer.size() - offset;
+            ++count;
+        }
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
         int w;
-        eintrwrap(w, ::send(mFd, &front[mBufferIdx], front.size() - mBufferIdx, sendflags));
+        eintrwrap(w, ::sendmsg(mFd, &msg, sendflags));
 
         if (w == -1) {
             ret = (errno == EWOULDBLOCK || errno == EAGAIN); // apparently these can be different
@@ -219,11 +261,9 @@ bool LocalClient::writeMore()
         }
         written += w;
         mBufferIdx += w;
-        if (mBufferIdx == front.size()) {
-            assert(!mBuffers.empty());
+        while (!mBuffers.empty() && mBufferIdx >= mBuffers.front()->size()) {
+            mBufferIdx -= mBuffers.front()->size();
             mBuffers.pop_front();
-            mBufferIdx = 0;
-            continue;
         }
     }
     if (written)
@@ -239,7 +279,7 @@ void LocalClient::event(const Event* event)
         assert(pthread_equal(pthread_self(), EventLoop::instance()->thread()));
         if (mBuffers.empty())
             EventLoop::instance()->addFileDescriptor(mFd, EventLoop::Read | EventLoop::Write, dataCallback, this);
-        mBuffers.push_back(ev->data);
+        mBuffers.insert(mBuffers.end(), ev->data.begin(), ev->data.end());
         writeMore();
         break; }
     default:
@@ -5,6 +5,7 @@
 #include "EventReceiver.h"
 #include "SignalSlot.h"
 #include <deque>
+#include <memory>
 
 class LocalClient : public EventReceiver
 {
@@ -19,8 +20,17 @@ public:
 
     ByteArray readAll();
     int read(char *buf, int size);
-    int bytesAvailable() const { return mReadBuffer.size() - mReadBufferPos; }
+    int bytesAvailable() const { return mReadBufferEnd - mReadBufferPos; }
+    // the unread data, valid until the next read, skip or readMore
+    const char *peek() const { return mReadBuffer.constData() + mReadBufferPos; }
+    void skip(int bytes);
+
+    // Buffers are queued as is and handed to sendmsg together, they must
+    // not be modified after being written
+    typedef std::shared_ptr<ByteArray> Buffer;
     bool write(const ByteArray& data);
+    bool write(const Buffer &buffer);
+    bool write(const List<Buffer> &buffers);
 
     signalslot::Signal0& dataAvailable() { return mDataAvailable; }
     signalslot::Signal0& connected() { return mConnected; }
@@ -39,10 +49,12 @@ private:
     signalslot::Signal0 mDataAvailable, mConnected, mDisconnected;
     signalslot::Signal1<int> mBytesWritten;
 
-    std::deque<ByteArray> mBuffers;
+    std::deque<Buffer> mBuffers;
     int mBufferIdx;
+    // received data lives in [mReadBufferPos, mReadBufferEnd), the rest of
+    // mReadBuffer is room for recv to write into
     ByteArray mReadBuffer;
-    int mReadBufferPos;
+    int mReadBufferPos, mReadBufferEnd;
 };
 
 #endif
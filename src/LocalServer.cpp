@@ -4,6 +4,7 @@
 #include "Log.h"
 #include "RTags.h"
 #include <errno.h>
+#include <fcntl.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/types.h>
@@ -38,11 +39,13 @@ bool LocalServer::listen(const Path& path)
         error("LocalServer::listen() Unable to create socket");
         return false;
     }
+    // make and friends have no business with our sockets
+    int ret;
+    eintrwrap(ret, fcntl(mFd, F_SETFD, FD_CLOEXEC));
 
     memset(&address, 0, sizeof(struct sockaddr_un));
 
     if (static_cast<int>(sizeof(address.sun_path)) - 1 <= path.size()) {
-        int ret;
         eintrwrap(ret, ::close(mFd));
         mFd = -1;
         error("LocalServer::listen() Path too long %s", path.constData());
@@ -53,7 +56,6 @@ bool LocalServer::listen(const Path& path)
     memcpy(address.sun_path, path.nullTerminated(), path.size() + 1);
 
     if (bind(mFd, (struct sockaddr*)&address, sizeof(struct sockaddr_un)) != 0) {
-        int ret;
         eintrwrap(ret, ::close(mFd));
         mFd = -1;
         error("LocalServer::listen() Unable to bind");
@@ -61,7 +63,6 @@ bool LocalServer::listen(const Path& path)
     }
 
     if (::listen(mFd, LISTEN_BACKLOG) != 0) {
-        int ret;
         eintrwrap(ret, ::close(mFd));
         error("LocalServer::listen() Unable to listen to socket");
         mFd = -1;
@@ -79,6 +80,8 @@ void LocalServer::listenCallback(int, unsigned int, void* userData)
     int clientFd;
     eintrwrap(clientFd, ::accept(server->mFd, NULL, NULL));
     if (clientFd != -1) {
+        int ret;
+        eintrwrap(ret, fcntl(clientFd, F_SETFD, FD_CLOEXEC));
         server->mPendingClients.push_back(clientFd);
         server->mClientConnected();
     }
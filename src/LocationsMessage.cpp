@@ -0,0 +1,32 @@
+#include "LocationsMessage.h"
+
+void LocationsMessage::add(const Location &location, uint32_t kind)
+{
+    const Entry entry = { location.fileId(), location.offset(), kind };
+    mEntries.append(entry);
+    Path &path = mPaths[entry.fileId];
+    if (path.isEmpty())
+        path = location.path();
+}
+
+void LocationsMessage::clear()
+{
+    mPaths.clear();
+    mEntries.clear();
+}
+
+ByteArray LocationsMessage::encode() const
+{
+    ByteArray data;
+    {
+        Serializer stream(data);
+        stream << mIndex << mKeyFlags << mPaths << mEntries;
+    }
+    return data;
+}
+
+void LocationsMessage::fromData(const char *data, int size)
+{
+    Deserializer stream(data, size);
+    stream >> mIndex >> mKeyFlags >> mPaths >> mEntries;
+}
@@ -0,0 +1,53 @@
+#ifndef LocationsMessage_h
+#define LocationsMessage_h
+
+#include "Message.h"
+#include "Location.h"
+#include "Map.h"
+#include "Path.h"
+#include "Serializer.h"
+
+// Binary response for QueryMessage::Binary queries. Locations go out as
+// packed (fileId, offset, kind) records together with the paths of the
+// file ids they use, the client formats them itself.
+class LocationsMessage : public Message
+{
+public:
+    enum { MessageId = 7 };
+
+    struct Entry {
+        uint32_t fileId;
+        uint32_t offset;
+        uint32_t kind; // CXCursorKind, 0 if unknown
+    };
+
+    LocationsMessage(int index = -1, unsigned keyFlags = 0)
+        : mIndex(index), mKeyFlags(keyFlags)
+    {}
+
+    virtual int messageId() const { return MessageId; }
+
+    // position of the query in a QueryMessage::Batch, -1 otherwise
+    int index() const { return mIndex; }
+    unsigned keyFlags() const { return mKeyFlags; }
+
+    void add(const Location &location, uint32_t kind);
+    bool isEmpty() const { return mEntries.isEmpty(); }
+    int count() const { return mEntries.size(); }
+    void clear();
+
+    const List<Entry> &entries() const { return mEntries; }
+    const Map<uint32_t, Path> &paths() const { return mPaths; }
+
+    ByteArray encode() const;
+    void fromData(const char *data, int size);
+private:
+    int mIndex;
+    unsigned mKeyFlags;
+    Map<uint32_t, Path> mPaths;
+    List<Entry> mEntries;
+};
+
+DECLARE_NATIVE_TYPE(LocationsMessage::Entry);
+
+#endif
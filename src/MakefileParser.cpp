@@ -1,18 +1,60 @@
 #include "MakefileParser.h"
 
+#include "Job.h"
 #include "List.h"
 #include "Log.h"
 #include "Process.h"
 #include "RTags.h"
 #include "RegExp.h"
+#include "Serializer.h"
+#include "Server.h"
 #include <stdio.h>
 
 #ifndef MAKE
 #define MAKE "make"
 #endif
 
+class MakefileLinesEvent : public Event
+{
+public:
+    enum { Type = 1 };
+    MakefileLinesEvent(const List<GccArguments> &a)
+        : Event(Type), args(a)
+    {}
+    const List<GccArguments> args;
+};
+
+// GccArguments::parse is by far the most expensive part of handling a line,
+// so it happens on the thread pool and the results are posted back
+class MakefileLinesJob : public ThreadPool::Job
+{
+public:
+    MakefileLinesJob(MakefileParser *parser, const List<MakefileParser::Line> &lines)
+        : mParser(parser), mLines(lines)
+    {}
+protected:
+    virtual void run()
+    {
+        List<GccArguments> ret;
+        const int count = mLines.size();
+        for (int i=0; i<count; ++i) {
+            GccArguments args;
+            if (args.parse(mLines.at(i).line, mLines.at(i).pwd)) {
+                ret.append(args);
+            // } else {
+            //     error("This didn't mean anything to me: [%s] in %s", mLines.at(i).line.constData(), mLines.at(i).pwd.constData());
+            }
+        }
+        mParser->postEvent(new MakefileLinesEvent(ret));
+    }
+private:
+    MakefileParser *mParser;
+    const List<MakefileParser::Line> mLines;
+};
+
 MakefileParser::MakefileParser(const List<ByteArray> &extraFlags, Connection *conn)
-    : mProc(0), mExtraCompilerFlags(extraFlags), mSourceCount(0), mConnection(conn)
+    : mProc(0), mScanned(0), mPendingJobs(0), mProcessDone(false), mExtraCompilerFlags(extraFlags),
+      mSourceCount(0), mConnection(conn), mFromCache(false)
 {
 }
 
@@ -30,9 +72,25 @@ void MakefileParser::stop()
     mProc = 0; // ###???
 }
 
-void MakefileParser::run(const Path &makefile, const List<ByteArray> &arguments)
+void MakefileParser::run(const Path &makefile, const List<ByteArray> &arguments, const Path &cache, bool useCache)
 {
     // error() << makefile << arguments;
+    mMakefile = makefile;
+    mCachePath = cache;
+    mArguments = arguments;
+    // the cache is still written when it isn't used
+    if (useCache && !mCachePath.isEmpty()) {
+        List<GccArguments> cached;
+        if (readCache(cached)) {
+            warning("Using cached make output for %s", makefile.constData());
+            mFromCache = true;
+            mProcessDone = true;
+            ++mPendingJobs;
+            postEvent(new MakefileLinesEvent(cached));
+            return;
+        }
+    }
+
     List<ByteArray> args = arguments;
     bool noTricks = false;
     const int noTricksIndex = arguments.indexOf("<no-make-tricks>");
@@ -50,7 +108,6 @@ void MakefileParser::run(const Path &makefile, const List<ByteArray> &arguments)
     } else {
         make = MAKE;
     }
-    mMakefile = makefile;
     assert(!mProc);
     mProc = new Process;
 
@@ -63,6 +120,9 @@ void MakefileParser::run(const Path &makefile, const List<ByteArray> &arguments)
     List<ByteArray> a;
     if (!noTricks)
         a.push_back("--dry-run");
+    // the data base tells us which makefiles the cache depends on
+    if (!mCachePath.isEmpty())
+        a.push_back("--print-data-base");
 
     a.push_back("--makefile=" + makefile);
     a.push_back("--directory=" + mCurrentPath);
@@ -83,7 +143,7 @@ void MakefileParser::run(const Path &makefile, const List<ByteArray> &arguments)
 
 bool MakefileParser::isDone() const
 {
-    return mProc && mProc->isFinished();
+    return mProcessDone && !mPendingJobs;
 }
 
 void MakefileParser::processMakeOutput()
@@ -91,12 +151,24 @@ void MakefileParser::processMakeOutput()
     assert(mProc);
     mData += mProc->readAllStdOut();
 
-    // ### this could be more efficient
-    int nextNewline = mData.indexOf('\n');
-    while (nextNewline != -1) {
-        processMakeLine(mData.left(nextNewline));
-        mData = mData.mid(nextNewline + 1);
-        nextNewline = mData.indexOf('\n');
+    // only scan what's new and drop all the complete lines in one go
+    const char *data = mData.constData();
+    const int size = mData.size();
+    int lineStart = 0;
+    List<Line> lines;
+    while (const char *newline = static_cast<const char*>(memchr(data + mScanned, '\n', size - mScanned))) {
+        const int end = newline - data;
+        processMakeLine(data + lineStart, end - lineStart, lines);
+        lineStart = mScanned = end + 1;
+    }
+    mScanned = size - lineStart;
+    if (lineStart)
+        mData.remove(0, lineStart);
+
+    if (!lines.isEmpty()) {
+        ++mPendingJobs;
+        std::shared_ptr<MakefileLinesJob> job(new MakefileLinesJob(this, lines));
+        Server::instance()->threadPool()->start(job, Job::Priority);
     }
 }
 
@@ -106,40 +178,155 @@ void MakefileParser::processMakeError()
     error("got stderr from make: '%s'", mProc->readAllStdErr().nullTerminated());
 }
 
-void MakefileParser::processMakeLine(const ByteArray &line)
+void MakefileParser::processMakeLine(const char *line, int length, List<Line> &lines)
 {
     int from = -1;
-    if (line.startsWith("RTAGS PWD=")) {
-        const int pipe = line.indexOf('|', 10);
+    if (length >= 10 && !strncmp(line, "RTAGS PWD=", 10)) {
+        const char *pipe = static_cast<const char*>(memchr(line + 10, '|', length - 10));
         if (!pipe) {
-            error("Can't parse line, no pipe [%s]", line.constData());
+            error("Can't parse line, no pipe [%s]", ByteArray(line, length).constData());
             return;
         }
-        const Path pwd = line.mid(10, pipe - 10);
-        mCurrentPath = pwd;
-        from = pipe + 1;
-    } else if (line.startsWith("RTAGS|")) {
+        mCurrentPath = Path(line + 10, pipe - line - 10);
+        if (!mCurrentPath.endsWith('/'))
+            mCurrentPath.append('/');
+        from = pipe - line + 1;
+    } else if (length >= 6 && !strncmp(line, "RTAGS|", 6)) {
         from = 6;
     } else {
+        if (!mCachePath.isEmpty())
+            processDataBaseLine(line, length);
         return;
     }
 
-    const ByteArray rest = line.mid(from);
-    warning("Parsing line [%s] in [%s]\n", rest.constData(), mCurrentPath.constData());
-
-    GccArguments args;
-    if (args.parse(rest, mCurrentPath)) {
-        // error("Parsed line [%s] in [%s] => [%s]", rest.constData(), mCurrentPath.constData(), args.inputFiles().value(0).constData());
+    const Line l = { ByteArray(line + from, length - from), mCurrentPath };
+    warning("Parsing line [%s] in [%s]\n", l.line.constData(), mCurrentPath.constData());
+    lines.append(l);
+}
 
-        args.addFlags(mExtraCompilerFlags);
-        ++mSourceCount;
-        fileReady()(args, this);
-    // } else {
-    //     error("This didn't mean anything to me: [%s] in %s", rest.constData(), mCurrentPath.constData());
+void MakefileParser::event(const Event *event)
+{
+    switch (event->type()) {
+    case MakefileLinesEvent::Type: {
+        const List<GccArguments> &args = static_cast<const MakefileLinesEvent*>(event)->args;
+        if (!mFromCache && !mCachePath.isEmpty())
+            mParsed.append(args);
+        const int count = args.size();
+        for (int i=0; i<count; ++i) {
+            ++mSourceCount;
+            GccArguments a = args.at(i);
+            a.addFlags(mExtraCompilerFlags);
+            fileReady()(a, this);
+        }
+        if (!--mPendingJobs && mProcessDone)
+            finish();
+        break; }
+    default:
+        EventReceiver::event(event);
+        break;
     }
 }
 
 void MakefileParser::onDone()
 {
+    mProcessDone = true;
+    if (!mPendingJobs)
+        finish();
+}
+
+void MakefileParser::finish()
+{
+    if (!mFromCache && !mCachePath.isEmpty() && mProc && !mProc->returnCode())
+        writeCache();
     done()(this);
 }
+
+// Each make, sub-makes included, prints its data base when it's done. Its
+// MAKEFILE_LIST is relative to its CURDIR and the two come in no particular
+// order so they're resolved at the end of the data base.
+void MakefileParser::processDataBaseLine(const char *line, int length)
+{
+    if (length > 10 && !strncmp(line, "CURDIR := ", 10)) {
+        mDataBaseDir = Path(line + 10, length - 10);
+        if (!mDataBaseDir.endsWith('/'))
+            mDataBaseDir.append('/');
+    } else if (length > 17 && !strncmp(line, "MAKEFILE_LIST := ", 17)) {
+        mDataBaseMakefiles = ByteArray(line + 17, length - 17).split(' ');
+    } else if (length >= 25 && !strncmp(line, "# Finished Make data base", 25)) {
+        for (int i=0; i<mDataBaseMakefiles.size(); ++i) {
+            const ByteArray &makefile = mDataBaseMakefiles.at(i);
+            if (!makefile.isEmpty())
+                mMakefiles.insert(Path::resolved(makefile, mDataBaseDir));
+        }
+        mDataBaseMakefiles.clear();
+        mDataBaseDir.clear();
+    }
+}
+
+static inline uint64_t lastModified(const Path &path)
+{
+    return path.isFile() ? static_cast<uint64_t>(path.lastModified()) : 0;
+}
+
+bool MakefileParser::readCache(List<GccArguments> &args) const
+{
+    FILE *f = fopen(mCachePath.constData(), "r");
+    if (!f)
+        return false;
+    Deserializer in(f);
+    int version;
+    in >> version;
+    bool ok = false;
+    if (version == CacheVersion) {
+        List<ByteArray> arguments;
+        Map<Path, uint64_t> inputs;
+        in >> arguments >> inputs;
+        bool changed = (arguments != mArguments);
+        for (Map<Path, uint64_t>::const_iterator it = inputs.begin(); !changed && it != inputs.end(); ++it)
+            changed = (lastModified(it->first) != it->second);
+        if (!changed) {
+            int count;
+            in >> count;
+            args.resize(count);
+            for (int i=0; i<count; ++i) {
+                GccArguments &a = args[i];
+                int type, lang;
+                in >> a.mClangArgs >> a.mInputFiles >> a.mUnresolvedInputFiles >> a.mOutputFile
+                   >> a.mBase >> a.mCompiler >> type >> lang;
+                a.mType = static_cast<GccArguments::Type>(type);
+                a.mLang = static_cast<GccArguments::Lang>(lang);
+            }
+            ok = true;
+        }
+    }
+    fclose(f);
+    return ok;
+}
+
+void MakefileParser::writeCache() const
+{
+    if (mMakefiles.isEmpty()) {
+        warning("No makefiles in the data base of %s, not caching it", mMakefile.constData());
+        return;
+    }
+    Map<Path, uint64_t> inputs;
+    inputs[mMakefile] = lastModified(mMakefile);
+    for (Set<Path>::const_iterator it = mMakefiles.begin(); it != mMakefiles.end(); ++it)
+        inputs[*it] = lastModified(*it);
+    Path::mkdir(mCachePath.parentDir());
+    FILE *f = fopen(mCachePath.constData(), "w");
+    if (!f) {
+        error("Can't open file %s", mCachePath.constData());
+        return;
+    }
+    Serializer out(f);
+    out << static_cast<int>(CacheVersion) << mArguments << inputs;
+    const int count = mParsed.size();
+    out << count;
+    for (int i=0; i<count; ++i) {
+        const GccArguments &a = mParsed.at(i);
+        out << a.mClangArgs << a.mInputFiles << a.mUnresolvedInputFiles << a.mOutputFile
+            << a.mBase << a.mCompiler << static_cast<int>(a.mType) << static_cast<int>(a.mLang);
+    }
+    fclose(f);
+}
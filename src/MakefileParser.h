@@ -2,21 +2,25 @@
 #define MAKEFILEPARSER_H
 
 #include "Path.h"
+#include "EventReceiver.h"
 #include "GccArguments.h"
 #include "List.h"
 #include "Map.h"
+#include "Set.h"
 #include "SignalSlot.h"
 
 class Connection;
 class Process;
 
-class MakefileParser
+class MakefileParser : public EventReceiver
 {
 public:
     MakefileParser(const List<ByteArray> &extraCompilerFlags, Connection *conn);
     ~MakefileParser();
 
-    void run(const Path &makefile, const List<ByteArray> &args);
+    // with a cache path the parsed arguments are stored there and replayed
+    // as long as none of the makefiles make read changed
+    void run(const Path &makefile, const List<ByteArray> &args, const Path &cache = Path(), bool useCache = false);
     void stop();
     bool isDone() const;
     List<ByteArray> extraCompilerFlags() const { return mExtraCompilerFlags; }
@@ -25,14 +29,27 @@ public:
     signalslot::Signal1<MakefileParser*> &done() { return mDone; }
     signalslot::Signal2<const GccArguments &, MakefileParser*> &fileReady() { return mFileReady; }
     int sourceCount() const { return mSourceCount; }
+    struct Line {
+        ByteArray line;
+        Path pwd;
+    };
+protected:
+    virtual void event(const Event *event);
 private:
     void processMakeOutput();
     void processMakeError();
-    void processMakeLine(const ByteArray &line);
+    void processMakeLine(const char *line, int length, List<Line> &lines);
     void onDone();
+    void finish();
+    void processDataBaseLine(const char *line, int length);
+    bool readCache(List<GccArguments> &args) const;
+    void writeCache() const;
 
     Process *mProc;
     ByteArray mData;
+    int mScanned; // bytes at the start of mData known not to contain a newline
+    int mPendingJobs;
+    bool mProcessDone;
     const List<ByteArray> mExtraCompilerFlags;
     int mSourceCount;
     Path mMakefile;
@@ -41,6 +58,16 @@ private:
     signalslot::Signal2<const GccArguments &, MakefileParser*> mFileReady;
     Map<Path, List<ByteArray> > mPendingFiles;
     Path mCurrentPath;
+
+    enum { CacheVersion = 2 };
+    Path mCachePath;
+    bool mFromCache;
+    List<ByteArray> mArguments;
+    // every makefile make read, from the MAKEFILE_LIST of each make's data base
+    Set<Path> mMakefiles;
+    Path mDataBaseDir;
+    List<ByteArray> mDataBaseMakefiles;
+    List<GccArguments> mParsed; // without the extra compiler flags
 };
 
 #endif // MAKEFILEPARSER_H
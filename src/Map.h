@@ -4,26 +4,30 @@
 #include <map>
 #include "List.h"
 
-template <typename Key, typename Value>
-class Map : public std::map<Key, Value>
+template <typename Key, typename Value, typename Alloc = std::allocator<std::pair<const Key, Value> > >
+class Map : public std::map<Key, Value, std::less<Key>, Alloc>
 {
+    typedef std::map<Key, Value, std::less<Key>, Alloc> Base;
 public:
     Map() {}
+    explicit Map(const Alloc &alloc)
+        : Base(std::less<Key>(), alloc)
+    {}
 
     bool contains(const Key &t) const
     {
-        return std::map<Key, Value>::find(t) != std::map<Key, Value>::end();
+        return Base::find(t) != Base::end();
     }
 
     bool isEmpty() const
     {
-        return !std::map<Key, Value>::size();
+        return !Base::size();
     }
 
     Value value(const Key &key, const Value &defaultValue = Value()) const
     {
-        typename std::map<Key, Value>::const_iterator it = std::map<Key, Value>::find(key);
-        if (it == std::map<Key, Value>::end()) {
+        typename Base::const_iterator it = Base::find(key);
+        if (it == Base::end()) {
             return defaultValue;
         }
         return it->second;
@@ -43,11 +47,11 @@ public:
 
     bool remove(const Key &t, Value *value = 0)
     {
-        typename std::map<Key, Value>::iterator it = std::map<Key, Value>::find(t);
-        if (it != std::map<Key, Value>::end()) {
+        typename Base::iterator it = Base::find(t);
+        if (it != Base::end()) {
             if (value)
                 *value = it->second;
-            std::map<Key, Value>::erase(it);
+            Base::erase(it);
             return true;
         }
         return false;
@@ -62,13 +66,13 @@ public:
     //     // return tup->second;
     // }
 
-    Map<Key, Value> &unite(const Map<Key, Value> &other)
+    Map &unite(const Map &other)
     {
-        typename std::map<Key, Value>::const_iterator it = other.begin();
+        typename Base::const_iterator it = other.begin();
         while (it != other.end()) {
             const Key &key = it->first;
             const Value &val = it->second;
-            std::map<Key, Value>::operator[](key) = val;
+            Base::operator[](key) = val;
             // std::map<Key, Value>::insert(it);
             // std::map<Key, Value>::operator[](it->first) = it->second;
             ++it;
@@ -76,36 +80,36 @@ public:
         return *this;
     }
 
-    Map<Key, Value> &subtract(const Map<Key, Value> &other)
+    Map &subtract(const Map &other)
     {
-        typename std::map<Key, Value>::iterator it = other.begin();
+        typename Base::iterator it = other.begin();
         while (it != other.end()) {
-            std::map<Key, Value>::erase(*it);
+            Base::erase(*it);
             ++it;
         }
         return *this;
     }
 
-    Map<Key, Value> &operator+=(const Map<Key, Value> &other)
+    Map &operator+=(const Map &other)
     {
         return unite(other);
     }
 
-    Map<Key, Value> &operator-=(const Map<Key, Value> &other)
+    Map &operator-=(const Map &other)
     {
         return subtract(other);
     }
 
     int size() const
     {
-        return std::map<Key, Value>::size();
+        return Base::size();
     }
 
     List<Key> keys() const
     {
         List<Key> keys;
-        typename std::map<Key, Value>::const_iterator it = std::map<Key, Value>::begin();
-        while (it != std::map<Key, Value>::end()) {
+        typename Base::const_iterator it = Base::begin();
+        while (it != Base::end()) {
             keys.append(it->first);
             ++it;
         }
@@ -115,8 +119,8 @@ public:
     List<Value> values() const
     {
         List<Value> values;
-        typename std::map<Key, Value>::const_iterator it = std::map<Key, Value>::begin();
-        while (it != std::map<Key, Value>::end()) {
+        typename Base::const_iterator it = Base::begin();
+        while (it != Base::end()) {
             values.append(it->second);
             ++it;
         }
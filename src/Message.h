@@ -4,9 +4,16 @@
 class Message
 {
 public:
-    Message() {}
+    Message() : mRequestId(0) {}
     virtual ~Message() {}
     virtual int messageId() const = 0;
+
+    // set by rc --server on its queries and by rdm on everything it sends
+    // back for them, 0 for the one query of a normal connection
+    int requestId() const { return mRequestId; }
+    void setRequestId(int id) { mRequestId = id; }
+private:
+    int mRequestId;
 };
 
 #endif // MESSAGE_H
@@ -43,19 +43,22 @@ void Messages::init()
     registerMessage<ResponseMessage>();
     registerMessage<CreateOutputMessage>();
     registerMessage<ProjectMessage>();
+    registerMessage<LocationsMessage>();
+    registerMessage<SharedMemoryMessage>();
+    registerMessage<FinishMessage>();
 }
 
 Message * Messages::create(const char *data, int size)
 {
-    if (size < static_cast<int>(sizeof(int))) {
+    if (size < static_cast<int>(sizeof(int) * 2)) {
         error("Can't create message from data (%d)", size);
         return 0;
     }
-    Deserializer ds(data, sizeof(int));
-    int id;
-    ds >> id;
-    size -= sizeof(int);
-    data += sizeof(int);
+    Deserializer ds(data, sizeof(int) * 2);
+    int id, requestId;
+    ds >> id >> requestId;
+    size -= sizeof(int) * 2;
+    data += sizeof(int) * 2;
     ReadLocker lock(&sLock);
     MessageCreatorBase *base = sFactory.value(id);
     if (!base) {
@@ -67,6 +70,7 @@ Message * Messages::create(const char *data, int size)
         error("Can't create message from data id: %d, data: %d bytes", id, size);
         return 0;
     }
+    message->setRequestId(requestId);
     return message;
 }
 void Messages::cleanup()
@@ -5,6 +5,9 @@
 #include "ProjectMessage.h"
 #include "ResponseMessage.h"
 #include "CreateOutputMessage.h"
+#include "LocationsMessage.h"
+#include "SharedMemoryMessage.h"
+#include "FinishMessage.h"
 
 class Messages
 {
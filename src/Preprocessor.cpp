@@ -20,15 +20,16 @@ void Preprocessor::preprocess()
         mProc = new Process;
         mProc->finished().connect(this, &Preprocessor::onProcessFinished);
     }
-    mArgs.args.append("-E");
-    mArgs.args.append(mArgs.sourceFile);
-    mProc->start(mArgs.compiler, mArgs.args);
+    List<ByteArray> args = mArgs.args();
+    args.append("-E");
+    args.append(mArgs.sourceFile);
+    mProc->start(mArgs.compiler, args);
 }
 
 void Preprocessor::onProcessFinished()
 {
     mConnection->write<256>("// %s %s", mArgs.compiler.constData(),
-                            ByteArray::join(mArgs.args, ' ').constData());
+                            ByteArray::join(mArgs.args(), ' ').constData());
     mConnection->write(mProc->readAllStdOut());
     const ByteArray err = mProc->readAllStdErr();
     if (!err.isEmpty()) {
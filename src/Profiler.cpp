@@ -0,0 +1,100 @@
+#include "Profiler.h"
+#include "EventLoop.h"
+
+uint64_t Profiler::now()
+{
+    timeval time;
+    EventLoop::gettime(&time);
+    return (uint64_t(time.tv_sec) * 1000000) + time.tv_usec;
+}
+
+const char *Profiler::phaseName(Phase phase)
+{
+    switch (phase) {
+    case Parse: return "parse";
+    case Diagnose: return "diagnose";
+    case Inclusions: return "inclusions";
+    case Visit: return "visit";
+    case Write: return "write";
+    case PhaseCount: break;
+    }
+    return "";
+}
+
+const char *Profiler::counterName(Counter counter)
+{
+    switch (counter) {
+    case CursorsVisited: return "cursors visited";
+    case CursorsBlocked: return "cursors blocked";
+    case LocationsCreated: return "locations created";
+    case NamePermutations: return "name permutations";
+    case IndexDataBytes: return "IndexData bytes";
+    case CounterCount: break;
+    }
+    return "";
+}
+
+void Profiler::Histogram::add(uint64_t value)
+{
+    ++count;
+    total += value;
+    if (value > max)
+        max = value;
+    int bucket = 0;
+    while (value && bucket < BucketCount - 1) {
+        value >>= 1;
+        ++bucket;
+    }
+    ++buckets[bucket];
+}
+
+void Profiler::Histogram::format(List<ByteArray> &out, const char *name, const char *unit) const
+{
+    if (!count)
+        return;
+    out.append(ByteArray::snprintf<256>("  %s: count %llu total %llu%s avg %llu%s max %llu%s", name,
+                                        static_cast<unsigned long long>(count),
+                                        static_cast<unsigned long long>(total), unit,
+                                        static_cast<unsigned long long>(total / count), unit,
+                                        static_cast<unsigned long long>(max), unit));
+    for (int i=0; i<BucketCount; ++i) {
+        if (buckets[i]) {
+            out.append(ByteArray::snprintf<256>("    < %llu%s: %llu",
+                                                static_cast<unsigned long long>(1) << i, unit,
+                                                static_cast<unsigned long long>(buckets[i])));
+        }
+    }
+}
+
+void Profiler::add(const Sample &sample)
+{
+    for (int i=0; i<PhaseCount; ++i) {
+        if (i != Write)
+            mPhases[i].add(sample.phases[i]);
+    }
+    for (int i=0; i<CounterCount; ++i)
+        mCounters[i].add(sample.counters[i]);
+}
+
+void Profiler::addWrite(uint64_t usec)
+{
+    mPhases[Write].add(usec);
+}
+
+void Profiler::clear()
+{
+    for (int i=0; i<PhaseCount; ++i)
+        mPhases[i] = Histogram();
+    for (int i=0; i<CounterCount; ++i)
+        mCounters[i] = Histogram();
+}
+
+List<ByteArray> Profiler::format() const
+{
+    List<ByteArray> ret;
+    for (int i=0; i<PhaseCount; ++i)
+        mPhases[i].format(ret, phaseName(static_cast<Phase>(i)), "us");
+    for (int i=0; i<CounterCount; ++i)
+        mCounters[i].format(ret, counterName(static_cast<Counter>(i)), "");
+    return ret;
+}
@@ -0,0 +1,76 @@
+#ifndef Profiler_h
+#define Profiler_h
+
+#include "ByteArray.h"
+#include "List.h"
+#include <stdint.h>
+#include <string.h>
+
+// Aggregates per translation unit timings and counters from IndexerJobs
+// into log2 histograms. Shown by rc --status profile.
+class Profiler
+{
+public:
+    enum Phase {
+        Parse,
+        Diagnose,
+        Inclusions,
+        Visit,
+        Write,
+        PhaseCount
+    };
+    enum Counter {
+        CursorsVisited,
+        CursorsBlocked,
+        // per cursor work is counted rather than timed, timing it would
+        // cost more than the work itself
+        LocationsCreated,
+        NamePermutations,
+        IndexDataBytes,
+        CounterCount
+    };
+
+    // what one job measured, times are in microseconds
+    struct Sample {
+        Sample() { memset(this, 0, sizeof(Sample)); }
+        uint64_t phases[PhaseCount];
+        uint64_t counters[CounterCount];
+    };
+
+    class Scope
+    {
+    public:
+        Scope(uint64_t &out)
+            : mOut(out), mStart(now())
+        {}
+        ~Scope() { mOut += now() - mStart; }
+    private:
+        uint64_t &mOut;
+        const uint64_t mStart;
+    };
+
+    static uint64_t now(); // microseconds, same clock as EventLoop's timers
+
+    void add(const Sample &sample); // Write is ignored, it isn't per job
+    void addWrite(uint64_t usec);
+    void clear();
+    List<ByteArray> format() const;
+
+    static const char *phaseName(Phase phase);
+    static const char *counterName(Counter counter);
+private:
+    struct Histogram {
+        Histogram() { memset(this, 0, sizeof(Histogram)); }
+        void add(uint64_t value);
+        void format(List<ByteArray> &out, const char *name, const char *unit) const;
+
+        enum { BucketCount = 40 }; // bucket n holds values in [2^(n-1), 2^n)
+        uint64_t count, total, max;
+        uint64_t buckets[BucketCount];
+    };
+
+    Histogram mPhases[PhaseCount];
+    Histogram mCounters[CounterCount];
+};
+
+#endif
@@ -4,8 +4,22 @@
 #include "GRTags.h"
 #include "Server.h"
 
+std::atomic<uint64_t> Project::sGeneration(0);
+
+static __thread int sHeldScopes = 0;
+
+int heldScopes()
+{
+    return sHeldScopes;
+}
+
+void addHeldScopes(int count)
+{
+    sHeldScopes += count;
+}
+
 Project::Project(const Path &src)
-    : srcRoot(src)
+    : srcRoot(src), mGeneration(++sGeneration)
 {
     resolvedSrcRoot = src;
     resolvedSrcRoot.resolve();
@@ -25,6 +39,7 @@ Scope<SymbolMap&> Project::lockSymbolsForWrite()
 {
     Scope<SymbolMap&> scope;
     mSymbolsLock.lockForWrite();
+    bumpGeneration();
     scope.mData.reset(new Scope<SymbolMap&>::Data(mSymbols, &mSymbolsLock));
     return scope;
 }
@@ -41,6 +56,7 @@ Scope<SymbolNameMap&> Project::lockSymbolNamesForWrite()
 {
     Scope<SymbolNameMap&> scope;
     mSymbolNamesLock.lockForWrite();
+    bumpGeneration();
     scope.mData.reset(new Scope<SymbolNameMap&>::Data(mSymbolNames, &mSymbolNamesLock));
     return scope;
 }
@@ -73,6 +89,7 @@ Scope<GRMap&> Project::lockGRForWrite()
 {
     Scope<GRMap&> scope;
     mGRLock.lockForWrite();
+    bumpGeneration();
     scope.mData.reset(new Scope<GRMap&>::Data(mGR, &mGRLock));
     return scope;
 }
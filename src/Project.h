@@ -1,12 +1,19 @@
 #ifndef Project_h
 #define Project_h
 
+#include <atomic>
 #include <memory>
 #include "Path.h"
 #include "RTags.h"
 #include "ReadWriteLock.h"
 #include "CursorInfo.h"
 
+// Number of project locks the calling thread holds through Scopes. The
+// main thread may be waiting for any of them so jobs don't wait for it
+// while this is non-zero.
+int heldScopes();
+void addHeldScopes(int count);
+
 template <typename T>
 class Scope
 {
@@ -20,10 +27,12 @@ private:
         Data(T tt, ReadWriteLock *l)
             : t(tt), lock(l)
         {
+            addHeldScopes(1);
         }
         ~Data()
         {
             lock->unlock();
+            addHeldScopes(-1);
         }
         T t;
         ReadWriteLock *lock;
@@ -63,9 +72,19 @@ public:
 
     bool isIndexed(uint32_t fileId) const;
 
+    // changes whenever the symbol, symbol name or GR maps are locked for
+    // writing. Unique across projects, results stamped with it are
+    // current as long as it stays the same.
+    uint64_t generation() const { return mGeneration; }
+
     bool save(Serializer &out);
     bool restore(Deserializer &in);
 private:
+    void bumpGeneration() { mGeneration = ++sGeneration; }
+
+    static std::atomic<uint64_t> sGeneration;
+    std::atomic<uint64_t> mGeneration;
+
     SymbolMap mSymbols;
     ReadWriteLock mSymbolsLock;
 
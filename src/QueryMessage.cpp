@@ -13,7 +13,7 @@ ByteArray QueryMessage::encode() const
     {
         Serializer stream(data);
         stream << mRaw << mQuery << mType << mFlags << mMax
-               << mPathFilters << mUnsavedFiles;
+               << mPathFilters << mUnsavedFiles << mBatch;
     }
     return data;
 }
@@ -22,7 +22,42 @@ void QueryMessage::fromData(const char *data, int size)
 {
     Deserializer stream(data, size);
     stream >> mRaw >> mQuery >> mType >> mFlags >> mMax
-           >> mPathFilters >> mUnsavedFiles;
+           >> mPathFilters >> mUnsavedFiles >> mBatch;
+}
+
+List<QueryMessage> QueryMessage::batch() const
+{
+    const int count = mBatch.size();
+    List<QueryMessage> ret(count);
+    for (int i=0; i<count; ++i) {
+        const ByteArray &data = mBatch.at(i);
+        ret[i].fromData(data.constData(), data.size());
+    }
+    return ret;
+}
+
+void QueryMessage::setBatch(const List<QueryMessage> &queries)
+{
+    const int count = queries.size();
+    mBatch.resize(count);
+    for (int i=0; i<count; ++i)
+        mBatch[i] = queries.at(i).encode();
+}
+
+bool QueryMessage::isBatchable(Type type)
+{
+    switch (type) {
+    case FollowLocation:
+    case ReferencesLocation:
+    case ReferencesName:
+    case ListSymbols:
+    case FindSymbols:
+    case CursorInfo:
+        return true;
+    default:
+        break;
+    }
+    return false;
 }
 
 unsigned QueryMessage::keyFlags(unsigned queryFlags)
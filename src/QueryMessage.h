@@ -31,7 +31,11 @@ public:
         DumpFile,
         HasFileManager,
         PreprocessFile,
-        Shutdown
+        Shutdown,
+        UnsavedFiles,
+        ClearUnsavedFile,
+        CodeComplete,
+        Batch
     };
 
     enum Flag {
@@ -46,7 +50,9 @@ public:
         MatchRegexp = 0x100,
         AbsolutePath = 0x200,
         FindVirtuals = 0x400,
-        Silent = 0x800
+        Silent = 0x800,
+        Binary = 0x1000,
+        SharedMemory = 0x2000
     };
 
     typedef Map<Path, ByteArray> UnsavedFilesMap;
@@ -76,6 +82,11 @@ public:
     unsigned flags() const { return mFlags; }
     void setFlags(unsigned flags) { mFlags = flags; }
 
+    // the queries of a Batch, answered in order against the same snapshot
+    List<QueryMessage> batch() const;
+    void setBatch(const List<QueryMessage> &queries);
+    static bool isBatchable(Type type);
+
     static unsigned keyFlags(unsigned queryFlags);
     inline unsigned keyFlags() const { return keyFlags(mFlags); }
 
@@ -89,6 +100,7 @@ private:
     int mMax;
     List<ByteArray> mPathFilters;
     Map<Path, ByteArray> mUnsavedFiles;
+    List<ByteArray> mBatch;
 };
 
 DECLARE_NATIVE_TYPE(QueryMessage::Type);
@@ -2,6 +2,8 @@
 #include "CreateOutputMessage.h"
 #include "ProjectMessage.h"
 #include "EventLoop.h"
+#include <unistd.h>
+#include <sys/stat.h>
 
 class RCCommand
 {
@@ -9,6 +11,8 @@ public:
     virtual ~RCCommand() {}
     virtual void exec(RClient *rc, Client *client) = 0;
     virtual ByteArray description() const = 0;
+    virtual bool isBatchable() const { return false; }
+    virtual bool isQuery() const { return false; }
 };
 
 class QueryCommand : public RCCommand
@@ -22,7 +26,7 @@ public:
     const ByteArray query;
     unsigned extraQueryFlags;
 
-    virtual void exec(RClient *rc, Client *client)
+    QueryMessage message(RClient *rc) const
     {
         QueryMessage msg(type);
         msg.init(rc->argc(), rc->argv());
@@ -31,9 +35,18 @@ public:
         msg.setMax(rc->max());
         msg.setUnsavedFiles(rc->unsavedFiles());
         msg.setPathFilters(rc->pathFilters().toList());
+        return msg;
+    }
+
+    virtual void exec(RClient *rc, Client *client)
+    {
+        const QueryMessage msg = message(rc);
         client->message(&msg);
     }
 
+    virtual bool isBatchable() const { return QueryMessage::isBatchable(type); }
+    virtual bool isQuery() const { return true; }
+
     virtual ByteArray description() const
     {
         return ("QueryMessage " + ByteArray::number(type) + " " + query);
@@ -103,13 +116,17 @@ public:
 
 RClient::RClient()
     : mQueryFlags(0), mClientFlags(0), mMakefileFlags(0), mMax(-1),
-      mLogLevel(0), mTimeout(0), mArgc(0), mArgv(0)
+      mLogLevel(0), mTimeout(0), mBatch(false), mPersistent(false), mRequest(false),
+      mInputClosed(false), mClient(0), mArgc(0), mArgv(0)
 {
 }
 
 RClient::~RClient()
 {
-    cleanupLogging();
+    for (int i=0; i<mCommands.size(); ++i)
+        delete mCommands.at(i);
+    if (!mRequest)
+        cleanupLogging();
 }
 
 QueryCommand *RClient::addQuery(QueryMessage::Type t, const ByteArray &query)
@@ -151,12 +168,55 @@ void RClient::exec()
 
     Client client(mSocketFile, mClientFlags, mRdmArgs);
 
+    if (mPersistent) {
+        mClient = &client;
+        client.requestFinished().connect(this, &RClient::onRequestFinished);
+        // epoll refuses regular files and /dev/null, those never block so
+        // just read them up front
+        struct stat st;
+        if (!fstat(STDIN_FILENO, &st) && !S_ISFIFO(st.st_mode) && !S_ISSOCK(st.st_mode) && !isatty(STDIN_FILENO)) {
+            while (!mInputClosed)
+                readRequests();
+        } else {
+            loop.addFileDescriptor(STDIN_FILENO, EventLoop::Read, stdinCallback, this);
+        }
+        loop.run();
+        loop.removeFileDescriptor(STDIN_FILENO);
+        mClient = 0;
+        return;
+    }
+
+    // with --batch the queries that can be batched go out in a single
+    // message, in place of the first of them
+    List<QueryMessage> batch;
     const int commandCount = mCommands.size();
+    if (mBatch) {
+        for (int i=0; i<commandCount; ++i) {
+            if (mCommands.at(i)->isBatchable())
+                batch.append(static_cast<QueryCommand*>(mCommands.at(i))->message(this));
+        }
+        if (batch.size() < 2)
+            batch.clear();
+    }
+
+    const bool batching = !batch.isEmpty();
     for (int i=0; i<commandCount; ++i) {
         RCCommand *cmd = mCommands.at(i);
-        debug() << "running command " << cmd->description();
         const int timeoutId = (mTimeout ? loop.addTimer(mTimeout, ::timeout, &loop) : -1);
-        cmd->exec(this, &client);
+        if (batching && cmd->isBatchable()) {
+            if (!batch.isEmpty()) {
+                QueryMessage msg(QueryMessage::Batch);
+                msg.init(mArgc, mArgv);
+                msg.setFlags(mQueryFlags);
+                msg.setBatch(batch);
+                debug() << "running batch of" << batch.size() << "queries";
+                batch.clear();
+                client.message(&msg);
+            }
+        } else {
+            debug() << "running command " << cmd->description();
+            cmd->exec(this, &client);
+        }
         if (timeoutId != -1)
             loop.removeTimer(timeoutId);
         delete cmd;
@@ -164,6 +224,132 @@ void RClient::exec()
     mCommands.clear();
 }
 
+void RClient::readRequests()
+{
+    char buf[16384];
+    int r;
+    do {
+        r = ::read(STDIN_FILENO, buf, sizeof(buf));
+    } while (r == -1 && errno == EINTR);
+    if (r <= 0) {
+        EventLoop::instance()->removeFileDescriptor(STDIN_FILENO);
+        mInputClosed = true;
+        if (!mClient->pendingRequests())
+            EventLoop::instance()->exit();
+        return;
+    }
+    mInput.append(buf, r);
+    int start = 0;
+    int eol;
+    while ((eol = mInput.indexOf('\n', start)) != -1) {
+        if (eol > start)
+            handleRequest(mInput.mid(start, eol - start));
+        start = eol + 1;
+    }
+    if (start)
+        mInput.remove(0, start);
+}
+
+// Splits a request the way a shell would, as far as Emacs'
+// combine-and-quote-strings needs: "..." with backslash escapes, '...' and
+// backslash escapes outside of quotes
+static List<ByteArray> splitArguments(const ByteArray &line)
+{
+    List<ByteArray> ret;
+    ByteArray arg;
+    bool inArg = false;
+    char quote = 0;
+    const int size = line.size();
+    for (int i=0; i<size; ++i) {
+        const char ch = line.at(i);
+        if (quote) {
+            if (ch == quote) {
+                quote = 0;
+            } else if (ch == '\\' && quote == '"' && i + 1 < size) {
+                arg.append(line.at(++i));
+            } else {
+                arg.append(ch);
+            }
+            continue;
+        }
+        switch (ch) {
+        case ' ':
+        case '\t':
+        case '\r':
+            if (inArg) {
+                ret.append(arg);
+                arg.clear();
+                inArg = false;
+            }
+            break;
+        case '"':
+        case '\'':
+            quote = ch;
+            inArg = true;
+            break;
+        case '\\':
+            if (i + 1 < size)
+                arg.append(line.at(++i));
+            inArg = true;
+            break;
+        default:
+            arg.append(ch);
+            inArg = true;
+            break;
+        }
+    }
+    if (inArg)
+        ret.append(arg);
+    return ret;
+}
+
+void RClient::handleRequest(const ByteArray &line)
+{
+    // <id> <rc arguments>
+    List<ByteArray> args = splitArguments(line);
+    const int requestId = args.isEmpty() ? 0 : atoi(args.first().constData());
+    if (requestId <= 0) {
+        fprintf(stderr, "rc: invalid request [%s]\n", line.constData());
+        return;
+    }
+    List<char*> argv;
+    argv.append(const_cast<char*>("rc"));
+    for (int i=1; i<args.size(); ++i)
+        argv.append(args[i].data());
+    argv.append(0);
+    int argc = argv.size() - 1;
+
+    // what was passed along with --server applies to every request
+    RClient request;
+    request.mRequest = true;
+    request.mQueryFlags = mQueryFlags;
+    request.mMax = mMax;
+    request.mPathFilters = mPathFilters;
+    bool sent = false;
+    if (request.parse(argc, argv.data())) {
+        for (int i=0; i<request.mCommands.size(); ++i) {
+            const RCCommand *cmd = request.mCommands.at(i);
+            if (!cmd->isQuery()) {
+                fprintf(stderr, "rc: --server only runs queries, not %s\n", cmd->description().constData());
+                continue;
+            }
+            const QueryMessage msg = static_cast<const QueryCommand*>(cmd)->message(&request);
+            if (mClient->request(requestId, &msg))
+                sent = true;
+        }
+    }
+    if (!sent) {
+        printf("%d.\n", requestId);
+        fflush(stdout);
+    }
+}
+
+void RClient::onRequestFinished(int)
+{
+    if (mInputClosed && !mClient->pendingRequests())
+        EventLoop::instance()->exit();
+}
+
 enum {
     None = 0,
     Verbose,
@@ -179,7 +365,8 @@ enum {
     ListSymbols,
     FindSymbols,
     CursorInfo,
-    // UnsavedFile,
+    UnsavedFile,
+    ClearUnsavedFile,
     LogFile,
     NoContext,
     Status,
@@ -215,7 +402,12 @@ enum {
     SmartProject,
     FindVirtuals,
     HasFileManager,
-    PreprocessFile
+    PreprocessFile,
+    CodeComplete,
+    Binary,
+    SharedMemory,
+    Batch,
+    ServerMode
 };
 
 struct Option {
@@ -239,7 +431,7 @@ struct Option opts[] = {
 
     { None, 0, 0, 0, "" },
     { None, 0, 0, 0, "Project management:" },
-    { Makefile, "makefile", 'm', optional_argument, "Process this makefile." },
+    { Makefile, "makefile", 'm', optional_argument, "Process this makefile or compile_commands.json." },
     { Clear, "clear", 'C', no_argument, "Clear projects." },
     { Project, "project", 'w', optional_argument, "With arg, select project matching that if unique, otherwise list all projects." },
     { DeleteProject, "delete-project", 'W', required_argument, "Delete all projects matching regexp." },
@@ -254,7 +446,8 @@ struct Option opts[] = {
     { ListSymbols, "list-symbols", 'S', optional_argument, "List symbol names matching arg." },
     { FindSymbols, "find-symbols", 'F', required_argument, "Find symbols matching arg." },
     { CursorInfo, "cursor-info", 'U', required_argument, "Get cursor info for this location." },
-    { Status, "status", 's', optional_argument, "Dump status of rdm. Arg can be symbols or symbolNames." },
+    { CodeComplete, "code-complete-at", 'b', required_argument, "Get code completions for this location. Combine with -u for unsaved buffers." },
+    { Status, "status", 's', optional_argument, "Dump status of rdm. Arg can be symbols, symbolNames, profile or cache." },
     { IsIndexed, "is-indexed", 'T', required_argument, "Check if rtags knows about, and is ready to return information about, this source file." },
     { HasFileManager, "has-filemanager", 0, optional_argument, "Check if rtags has info about files in this directory." },
     { PreprocessFile, "preprocess", 0, required_argument, "Preprocess file." },
@@ -268,7 +461,8 @@ struct Option opts[] = {
     { SkipParen, "skip-paren", 'p', no_argument, "Skip parens in various contexts." },
     { Max, "max", 'M', required_argument, "Max lines of output for queries." },
     { ReverseSort, "reverse-sort", 'O', no_argument, "Sort output reversed." },
-//        { UnsavedFile, "unsaved-file", 'u', required_argument, },
+    { UnsavedFile, "unsaved-file", 'u', required_argument, "Read [arg] bytes of unsaved contents for this file from stdin and reindex it. Format is file:bytes." },
+    { ClearUnsavedFile, "clear-unsaved-file", 0, required_argument, "Forget the unsaved contents sent for this file with -u and reindex what's on disk." },
     { LogFile, "log-file", 'L', required_argument, "Log to this file." },
     { NoContext, "no-context", 'N', no_argument, "Don't print context for locations." },
     { LineNumbers, "line-numbers", 'l', no_argument, "Output line numbers instead of offsets." },
@@ -290,6 +484,11 @@ struct Option opts[] = {
     { Timeout, "timeout", 'y', required_argument, "Max time in ms to wait for job to finish (default no timeout)." },
     { SniffMake, "sniff-make", 'J', no_argument, "No make trickery, only parse the output. Assumes you've run make clean first." },
     { FindVirtuals, "find-virtuals", 'k', no_argument, "Use in combinations with -R or -r to show other implementations of this function." },
+    { Binary, "binary", 0, no_argument, "Have rdm send locations as binary records, formatted by rc." },
+    { SharedMemory, "shared-memory", 0, no_argument, "Let rdm hand large responses over in shared memory instead of the socket." },
+    { Batch, "batch", 0, no_argument, "Send all location and symbol queries in one request, answered against the same snapshot. Each result is preceded by --- <n>." },
+    { ServerMode, "server", 0, no_argument, "Keep a connection to rdm open and run queries read from stdin, one per line as <id> <rc options>. "
+      "Each line of output is prefixed with <id>: and <id>. marks the end of the response. Command flags passed along apply to every query." },
     { None, 0, 0, 0, 0 }
 };
 
@@ -326,8 +525,18 @@ static void help(FILE *f, const char* app)
 
 bool RClient::parse(int &argc, char **argv)
 {
-    RTags::findApplicationDirPath(*argv);
-    mSocketFile = Path::home() + ".rdm";
+    if (mRequest) {
+        // getopt_long keeps its state in globals, start over for each request
+#if defined(OS_Darwin) || defined(OS_FreeBSD)
+        optreset = 1;
+        optind = 1;
+#else
+        optind = 0;
+#endif
+    } else {
+        RTags::findApplicationDirPath(*argv);
+        mSocketFile = Path::home() + ".rdm";
+    }
 
     List<option> options;
     options.reserve(sizeof(opts) / sizeof(Option));
@@ -366,7 +575,7 @@ bool RClient::parse(int &argc, char **argv)
     Path logFile;
     unsigned logFlags = 0;
 
-    // Unused: Abcz
+    // Unused: Acz
 
     while (true) {
         int idx = -1;
@@ -389,7 +598,7 @@ bool RClient::parse(int &argc, char **argv)
 
         switch (opt->option) {
         case Help:
-            help(stdout, argv[0]);
+            help(mRequest ? stderr : stdout, argv[0]);
             return 0;
         case SocketFile:
             mSocketFile = optarg;
@@ -431,6 +640,22 @@ bool RClient::parse(int &argc, char **argv)
         case ElispList:
             mQueryFlags |= QueryMessage::ElispList;
             break;
+        case Binary:
+            mQueryFlags |= QueryMessage::Binary;
+            break;
+        case SharedMemory:
+            mQueryFlags |= QueryMessage::SharedMemory;
+            break;
+        case Batch:
+            mBatch = true;
+            break;
+        case ServerMode:
+            if (mRequest) {
+                fprintf(stderr, "--server can't be used in a request\n");
+                return false;
+            }
+            mPersistent = true;
+            break;
         case FilterSystemHeaders:
             mQueryFlags |= QueryMessage::FilterSystemIncludes;
             break;
@@ -479,34 +704,49 @@ bool RClient::parse(int &argc, char **argv)
                 return false;
             }
             break;
-            // case UnsavedFile: {
-            //     const ByteArray arg(optarg);
-            //     const int colon = arg.lastIndexOf(':');
-            //     if (colon == -1) {
-            //         fprintf(stderr, "Can't parse -u [%s]\n", optarg);
-            //         return false;
-            //     }
-            //     const int bytes = atoi(arg.constData() + colon + 1);
-            //     if (!bytes) {
-            //         fprintf(stderr, "Can't parse -u [%s]\n", optarg);
-            //         return false;
-            //     }
-            //     const Path path = Path::resolved(arg.left(colon));
-            //     if (!path.isFile()) {
-            //         fprintf(stderr, "Can't open [%s] for reading\n", arg.left(colon).nullTerminated());
-            //         return false;
-            //     }
-
-            //     ByteArray contents(bytes, '\0');
-            //     const int r = fread(contents.data(), 1, bytes, stdin);
-            //     if (r != bytes) {
-            //         fprintf(stderr, "Read error %d (%s). Got %d, expected %d\n",
-            //                 errno, strerror(errno), r, bytes);
-            //     }
-            //     mUnsavedFiles[path] = contents;
-            //     break; }
+        case UnsavedFile: {
+            if (mRequest) {
+                // stdin is the request stream
+                fprintf(stderr, "-u can't be used with --server\n");
+                return false;
+            }
+            const ByteArray arg(optarg);
+            const int colon = arg.lastIndexOf(':');
+            if (colon == -1) {
+                fprintf(stderr, "Can't parse -u [%s]\n", optarg);
+                return false;
+            }
+            const int bytes = atoi(arg.constData() + colon + 1);
+            if (bytes < 0) {
+                fprintf(stderr, "Can't parse -u [%s]\n", optarg);
+                return false;
+            }
+            const Path path = Path::resolved(arg.left(colon));
+            if (!path.isFile()) {
+                fprintf(stderr, "Can't open [%s] for reading\n", arg.left(colon).nullTerminated());
+                return false;
+            }
+
+            ByteArray contents(bytes, '\0');
+            if (bytes) {
+                const int r = fread(contents.data(), 1, bytes, stdin);
+                if (r != bytes) {
+                    fprintf(stderr, "Read error %d (%s). Got %d, expected %d\n",
+                            errno, strerror(errno), r, bytes);
+                    return false;
+                }
+            }
+            if (mUnsavedFiles.isEmpty())
+                addQuery(QueryMessage::UnsavedFiles);
+            mUnsavedFiles[path] = contents;
+            break; }
+        case ClearUnsavedFile:
+            // the buffer may never have been saved, don't insist on the file
+            addQuery(QueryMessage::ClearUnsavedFile, Path::resolved(optarg));
+            break;
         case FollowLocation:
         case CursorInfo:
+        case CodeComplete:
         case ReferenceLocation: {
             const ByteArray encoded = Location::encodeClientLocation(optarg);
             if (encoded.isEmpty()) {
@@ -517,6 +757,7 @@ bool RClient::parse(int &argc, char **argv)
             switch (opt->option) {
             case FollowLocation: type = QueryMessage::FollowLocation; break;
             case CursorInfo: type = QueryMessage::CursorInfo; break;
+            case CodeComplete: type = QueryMessage::CodeComplete; break;
             case ReferenceLocation: type = QueryMessage::ReferencesLocation; break;
             }
             addQuery(type, encoded);
@@ -671,14 +912,15 @@ bool RClient::parse(int &argc, char **argv)
         return false;
     }
 
-    if (!initLogging(mLogLevel, logFile, logFlags)) {
+    if (!mRequest && !initLogging(mLogLevel, logFile, logFlags)) {
         fprintf(stderr, "Can't initialize logging with %d %s 0x%0x\n",
                 mLogLevel, logFile.constData(), logFlags);
         return false;
     }
 
 
-    if (mCommands.isEmpty() && !(mClientFlags & (Client::RestartRdm|Client::AutostartRdm))) {
+    if (mCommands.isEmpty() && !mPersistent && !mRequest
+        && !(mClientFlags & (Client::RestartRdm|Client::AutostartRdm))) {
         help(stderr, argv[0]);
         return false;
     }
@@ -35,6 +35,11 @@ public:
     int argc() const { return mArgc; }
     char **argv() const { return mArgv; }
 private:
+    void readRequests();
+    void handleRequest(const ByteArray &line);
+    void onRequestFinished(int requestId);
+    static void stdinCallback(int, unsigned int, void *userData) { static_cast<RClient*>(userData)->readRequests(); }
+
     QueryCommand *addQuery(QueryMessage::Type t, const ByteArray &query = ByteArray());
     void addLog(int level);
     void addMakeFile(const Path &makefile, const List<ByteArray> &args);
@@ -43,6 +48,11 @@ private:
 
     unsigned mQueryFlags, mClientFlags, mMakefileFlags;
     int mMax, mLogLevel, mTimeout;
+    bool mBatch;
+    // rc --server, mRequest is set on the RClient parsing one of its requests
+    bool mPersistent, mRequest, mInputClosed;
+    Client *mClient;
+    ByteArray mInput;
     Set<ByteArray> mPathFilters;
     Map<Path, ByteArray> mUnsavedFiles;
     List<ByteArray> mExtraCompilerFlags;
@@ -160,6 +160,17 @@ void removeDirectory(const Path &path)
     }
     rmdir(path.constData());
 }
+
+uint64_t hashFile(const Path &path)
+{
+    char *buf;
+    const int size = path.readAll(buf);
+    if (size < 0)
+        return 0;
+    const uint64_t ret = hash(buf, size);
+    delete[] buf;
+    return ret ? ret : 1;
+}
 bool startProcess(const Path &dotexe, const List<ByteArray> &dollarArgs)
 {
     switch (fork()) {
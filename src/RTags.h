@@ -49,6 +49,7 @@ typedef Map<uint32_t, SourceInformation> SourceInformationMap;
 typedef Map<Path, Set<ByteArray> > FilesMap;
 typedef Map<Location, std::pair<int, ByteArray> > FixitMap;
 typedef Map<uint32_t, List<ByteArray> > DiagnosticsMap;
+typedef Map<Path, ByteArray> UnsavedFilesMap;
 typedef Map<Path, std::shared_ptr<Project> > ProjectsMap;
 typedef Map<uint32_t, time_t> GRFilesMap;
 // file id to last modified, time_t means currently parsing
@@ -153,9 +154,21 @@ inline int digits(int len)
     return ret;
 }
 
+static const uint64_t FNVOffsetBasis = 14695981039346656037ULL;
+// 64-bit FNV-1a, pass the previous result to hash data in pieces
+inline uint64_t hash(const char *data, int length, uint64_t hash = FNVOffsetBasis)
+{
+    for (int i=0; i<length; ++i) {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
 ByteArray shortOptions(const option *longOptions);
 int readLine(FILE *f, char *buf = 0, int max = -1);
 void removeDirectory(const Path &path);
+uint64_t hashFile(const Path &path); // 0 if it can't be read
 int canonicalizePath(char *path, int len);
 ByteArray unescape(ByteArray command);
 
@@ -87,7 +87,28 @@ inline bool startsWith(const List<T> &list, const T &str)
     return false;
 }
 
-SymbolMap::const_iterator findCursorInfo(const SymbolMap &map, const Location &location);
+// templated so it works for IndexData::Symbols too
+template <typename Symbols>
+typename Symbols::const_iterator findCursorInfo(const Symbols &map, const Location &location)
+{
+    if (map.isEmpty())
+        return map.end();
+    typename Symbols::const_iterator it = map.lower_bound(location);
+    if (it == map.end()) {
+        --it;
+    } else {
+        const int cmp = it->first.compare(location);
+        if (!cmp)
+            return it;
+        --it;
+    }
+    if (location.fileId() != it->first.fileId())
+        return map.end();
+    const int off = location.offset() - it->first.offset();
+    if (it->second.symbolLength > off)
+        return it;
+    return map.end();
+}
 inline CursorInfo findCursorInfo(const SymbolMap &map, const Location &location, Location *key)
 {
     const SymbolMap::const_iterator it = findCursorInfo(map, location);
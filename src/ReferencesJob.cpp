@@ -123,10 +123,9 @@ void ReferencesJob::execute()
     if (!(queryFlags() & QueryMessage::ReverseSort) && sorted.size() != 1 && !startLocation.isNull()) {
         startIndex = sorted.indexOf(startLocation) + 1;
     }
-    const unsigned keyFlags = Job::keyFlags();
-
     for (int i=0; i<count; ++i) {
         const Location &loc = sorted.at((startIndex + i) % count);
-        write(loc.key(keyFlags));
+        if (!writeLocation(loc))
+            return;
     }
 }
@@ -0,0 +1,105 @@
+#include "ResultCache.h"
+#include "QueryMessage.h"
+#include "Serializer.h"
+
+ResultCache::ResultCache()
+    : mBytes(0), mHits(0), mMisses(0), mStale(0)
+{
+}
+
+bool ResultCache::isCacheable(const QueryMessage &query)
+{
+    switch (query.type()) {
+    case QueryMessage::FollowLocation:
+    case QueryMessage::ReferencesLocation:
+    case QueryMessage::ReferencesName:
+    case QueryMessage::ListSymbols:
+    case QueryMessage::FindSymbols:
+    case QueryMessage::CursorInfo:
+        return true;
+    default:
+        break;
+    }
+    return false;
+}
+
+ByteArray ResultCache::key(const QueryMessage &query, const Path &project)
+{
+    ByteArray ret;
+    {
+        Serializer stream(ret);
+        stream << project << query.type() << query.query() << query.flags()
+               << query.pathFilters() << query.max();
+    }
+    return ret;
+}
+
+bool ResultCache::find(const ByteArray &key, uint64_t generation, List<Output> &output)
+{
+    Map<ByteArray, std::list<Entry>::iterator>::iterator it = mIndex.find(key);
+    if (it == mIndex.end()) {
+        ++mMisses;
+        return false;
+    }
+    std::list<Entry>::iterator entry = it->second;
+    if (entry->generation != generation) {
+        ++mStale;
+        ++mMisses;
+        erase(entry);
+        return false;
+    }
+    ++mHits;
+    mEntries.splice(mEntries.begin(), mEntries, entry);
+    output = entry->output;
+    return true;
+}
+
+void ResultCache::insert(const ByteArray &key, uint64_t generation, const List<Output> &output)
+{
+    int bytes = key.size();
+    for (int i=0; i<output.size(); ++i)
+        bytes += output.at(i).data.size();
+    if (bytes > MaxEntryBytes)
+        return;
+
+    Map<ByteArray, std::list<Entry>::iterator>::iterator it = mIndex.find(key);
+    if (it != mIndex.end())
+        erase(it->second);
+
+    Entry entry = { key, generation, output, bytes };
+    mEntries.push_front(entry);
+    mIndex[key] = mEntries.begin();
+    mBytes += bytes;
+    while (static_cast<int>(mEntries.size()) > MaxEntries || mBytes > MaxBytes) {
+        std::list<Entry>::iterator last = mEntries.end();
+        erase(--last);
+    }
+}
+
+void ResultCache::erase(std::list<Entry>::iterator it)
+{
+    mBytes -= it->bytes;
+    mIndex.remove(it->key);
+    mEntries.erase(it);
+}
+
+void ResultCache::clear()
+{
+    mEntries.clear();
+    mIndex.clear();
+    mBytes = 0;
+}
+
+List<ByteArray> ResultCache::format() const
+{
+    List<ByteArray> ret;
+    const uint64_t lookups = mHits + mMisses;
+    ret.append(ByteArray::snprintf<128>("  entries: %d (%d bytes)", static_cast<int>(mEntries.size()), mBytes));
+    ret.append(ByteArray::snprintf<256>("  lookups: %llu hits %llu (%llu%%) misses %llu stale %llu",
+                                        static_cast<unsigned long long>(lookups),
+                                        static_cast<unsigned long long>(mHits),
+                                        static_cast<unsigned long long>(lookups ? mHits * 100 / lookups : 0),
+                                        static_cast<unsigned long long>(mMisses),
+                                        static_cast<unsigned long long>(mStale)));
+    return ret;
+}
@@ -0,0 +1,57 @@
+#ifndef ResultCache_h
+#define ResultCache_h
+
+#include "ByteArray.h"
+#include "List.h"
+#include "Map.h"
+#include "Path.h"
+#include <list>
+#include <stdint.h>
+
+class QueryMessage;
+
+// Output of recent read-only queries, keyed by the query and the project
+// it ran against and stamped with the project's generation. Entries from
+// an older generation are dropped when they're looked up. Least recently
+// used entries go first once there are too many or they take up too much
+// memory. Main thread only.
+class ResultCache
+{
+public:
+    enum {
+        MaxEntries = 512,
+        MaxBytes = 16 * 1024 * 1024,
+        MaxEntryBytes = 256 * 1024
+    };
+
+    struct Output {
+        int messageId;
+        ByteArray data;
+    };
+
+    ResultCache();
+
+    static bool isCacheable(const QueryMessage &query);
+    static ByteArray key(const QueryMessage &query, const Path &project);
+
+    bool find(const ByteArray &key, uint64_t generation, List<Output> &output);
+    void insert(const ByteArray &key, uint64_t generation, const List<Output> &output);
+    void clear();
+
+    List<ByteArray> format() const;
+private:
+    struct Entry {
+        ByteArray key;
+        uint64_t generation;
+        List<Output> output;
+        int bytes;
+    };
+    void erase(std::list<Entry>::iterator it);
+
+    std::list<Entry> mEntries; // most recently used first
+    Map<ByteArray, std::list<Entry>::iterator> mIndex;
+    int mBytes;
+    uint64_t mHits, mMisses, mStale;
+};
+
+#endif
@@ -1,6 +1,9 @@
 #include "Server.h"
+#include "BatchJob.h"
 
 #include "Client.h"
+#include "CompilationDatabase.h"
+#include "CompletionJob.h"
 #include "Connection.h"
 #include "CreateOutputMessage.h"
 #include "CursorInfoJob.h"
@@ -30,11 +33,14 @@
 #include "ReferencesJob.h"
 #include "RegExp.h"
 #include "SHA256.h"
+#include "SharedMemoryMessage.h"
 #include "StatusJob.h"
 #include "TestJob.h"
 #include <clang-c/Index.h>
 #include <dirent.h>
 #include <fnmatch.h>
+#include <limits.h>
+#include <sys/ipc.h>
 #include <stdio.h>
 
 class MakefileParserDoneEvent : public Event
@@ -49,7 +55,7 @@ public:
 
 Server *Server::sInstance = 0;
 Server::Server()
-    : mServer(0), mVerbose(false), mJobId(0), mThreadPool(0)
+    : mServer(0), mProjectsVersion(0), mVerbose(false), mJobId(0), mThreadPool(0)
 {
     assert(!sInstance);
     sInstance = this;
@@ -65,11 +71,20 @@ Server::~Server()
 
 void Server::clear()
 {
+    // jobs waiting for their output to drain would never finish
+    for (Map<int, std::weak_ptr<Job> >::const_iterator it = mJobs.begin(); it != mJobs.end(); ++it) {
+        if (std::shared_ptr<Job> job = it->second.lock())
+            job->abort();
+    }
+    mJobs.clear();
+    mCachedLookups.clear();
+    mResultCache.clear();
     if (mThreadPool) {
         mThreadPool->clearBackLog();
         delete mThreadPool;
         mThreadPool = 0;
     }
+    CompletionJob::clearCache();
     mProjects.clear();
     Path::rm(mOptions.socketFile);
     delete mServer;
@@ -155,7 +170,9 @@ bool Server::init(const Options &options)
 
     mServer->clientConnected().connect(this, &Server::onNewConnection);
 
-    remake();
+    // only startup replays the cached make output, explicit requests and
+    // modified makefiles run make
+    remake(ByteArray(), 0, true);
 
     return true;
 }
@@ -169,21 +186,66 @@ void Server::onNewConnection()
         Connection *conn = new Connection(client);
         conn->newMessage().connect(this, &Server::onNewMessage);
         conn->destroyed().connect(this, &Server::onConnectionDestroyed);
+        conn->closed().connect(this, &Server::onConnectionClosed);
+        conn->bytesWritten().connect(this, &Server::onConnectionBytesWritten);
         // client->disconnected().connect(conn, &Connection::onLoop);
     }
 }
 
 void Server::onConnectionDestroyed(Connection *o)
 {
+    abortJobs(o);
+    mConnectionStates.remove(o);
     Map<int, Connection*>::iterator it = mPendingLookups.begin();
     const Map<int, Connection*>::const_iterator end = mPendingLookups.end();
     while (it != end) {
         if (it->second == o) {
+            mRequestIds.remove(it->first);
+            mSharedMemoryJobs.remove(it->first);
             mPendingLookups.erase(it++);
         } else {
             ++it;
         }
     }
+    for (Map<Path, PendingCompilationDatabase>::iterator it = mPendingCompilationDatabases.begin();
+         it != mPendingCompilationDatabases.end(); ++it) {
+        if (it->second.connection == o)
+            it->second.connection = 0;
+    }
+}
+
+void Server::onConnectionClosed(Connection *o)
+{
+    // nobody's listening anymore
+    abortJobs(o);
+}
+
+void Server::abortJobs(Connection *o)
+{
+    mPendingOutput.remove(o);
+    mSharedOutput.remove(o);
+    mPendingFinish.remove(o);
+    for (Map<int, Connection*>::const_iterator it = mPendingLookups.begin(); it != mPendingLookups.end(); ++it) {
+        if (it->second == o) {
+            if (std::shared_ptr<Job> job = mJobs.value(it->first).lock())
+                job->abort();
+        }
+    }
+}
+
+void Server::onConnectionBytesWritten(Connection *o, int)
+{
+    if (o->pendingWrite() > Job::LowWaterMark)
+        return;
+    Map<Connection*, List<std::pair<std::weak_ptr<Job>, int> > >::iterator it = mPendingOutput.find(o);
+    if (it == mPendingOutput.end())
+        return;
+    const List<std::pair<std::weak_ptr<Job>, int> > &pending = it->second;
+    for (int i=0; i<pending.size(); ++i) {
+        if (std::shared_ptr<Job> job = pending.at(i).first.lock())
+            job->outputWritten(pending.at(i).second);
+    }
+    mPendingOutput.erase(it);
 }
 
 void Server::onNewMessage(Message *message, Connection *connection)
@@ -196,12 +258,23 @@ void Server::onNewMessage(Message *message, Connection *connection)
     case ProjectMessage::MessageId:
         handleProjectMessage(static_cast<ProjectMessage*>(message), connection);
         break;
-    case QueryMessage::MessageId:
+    case QueryMessage::MessageId: {
+        // requests from rc --server share a connection, everything written
+        // while handling one is tagged with its id
+        const bool silent = connection->isSilent();
+        connection->setRequestId(message->requestId());
         handleQueryMessage(static_cast<QueryMessage*>(message), connection);
-        break;
+        if (message->requestId()) {
+            connection->setRequestId(0);
+            connection->setSilent(silent);
+        }
+        break; }
     case CreateOutputMessage::MessageId:
         handleCreateOutputMessage(static_cast<CreateOutputMessage*>(message), connection);
         break;
+    case SharedMemoryMessage::MessageId:
+        handleSharedMemoryMessage(static_cast<SharedMemoryMessage*>(message), connection);
+        break;
     case ResponseMessage::MessageId:
     default:
         error("Unknown message: %d", message->messageId());
@@ -242,8 +315,10 @@ void Server::handleProjectMessage(ProjectMessage *message, Connection *conn)
 bool Server::grtag(const Path &dir)
 {
     std::shared_ptr<Project> &project = mProjects[dir];
-    if (!project)
+    if (!project) {
         project.reset(new Project(dir));
+        ++mProjectsVersion;
+    }
     if (project->grtags)
         return false;
     if (!project->fileManager) {
@@ -259,8 +334,12 @@ bool Server::grtag(const Path &dir)
 }
 
 void Server::make(const Path &path, const List<ByteArray> &makefileArgs,
-                  const List<ByteArray> &extraCompilerFlags, Connection *conn)
+                  const List<ByteArray> &extraCompilerFlags, Connection *conn, bool useCache)
 {
+    if (CompilationDatabase::isCompilationDatabase(path)) {
+        loadCompilationDatabase(path, extraCompilerFlags, conn);
+        return;
+    }
     std::shared_ptr<Project> project = mProjects.value(path);
     if (project) {
         assert(project->indexer);
@@ -270,7 +349,14 @@ void Server::make(const Path &path, const List<ByteArray> &makefileArgs,
     MakefileParser *parser = new MakefileParser(extraCompilerFlags, conn);
     parser->fileReady().connect(this, &Server::onFileReady);
     parser->done().connect(this, &Server::onMakefileParserDone);
-    parser->run(path, makefileArgs);
+    parser->run(path, makefileArgs, makefileCachePath(path), useCache);
+}
+
+Path Server::makefileCachePath(const Path &makefile) const
+{
+    Path path = makefile;
+    RTags::encodePath(path);
+    return mOptions.dataDir + path + ".make";
 }
 
 void Server::onMakefileParserDone(MakefileParser *parser)
@@ -290,6 +376,145 @@ void Server::onMakefileParserDone(MakefileParser *parser)
     EventLoop::instance()->postEvent(this, new MakefileParserDoneEvent(parser));
 }
 
+void Server::loadCompilationDatabase(const Path &path, const List<ByteArray> &extraCompilerFlags, Connection *conn)
+{
+    if (mPendingCompilationDatabases.contains(path)) {
+        if (conn) {
+            conn->write<256>("%s is already being loaded", path.constData());
+            conn->finish();
+        }
+        return;
+    }
+    Timer timer;
+    List<CompilationDatabase::Command> commands;
+    if (!CompilationDatabase::load(path, commands) || commands.isEmpty()) {
+        if (conn) {
+            conn->write<256>("Can't load %s", path.constData());
+            conn->finish();
+        }
+        return;
+    }
+
+    std::shared_ptr<Project> project = mProjects.value(path);
+    if (project) {
+        assert(project->indexer);
+        project->indexer->beginMakefile();
+    }
+
+    // GccArguments::parse is the expensive part, spread it over the pool in
+    // a few chunks per thread so results start arriving early
+    const int count = commands.size();
+    const int chunkSize = std::max(16, count / (std::max(1, mOptions.threadCount) * 4));
+    PendingCompilationDatabase &pending = mPendingCompilationDatabases[path];
+    pending.jobs = (count + chunkSize - 1) / chunkSize;
+    pending.sources = 0;
+    pending.connection = conn;
+    pending.timer = timer;
+    for (int i=0; i<count; i += chunkSize) {
+        List<CompilationDatabase::Command> chunk;
+        chunk.assign(commands.begin() + i, commands.begin() + std::min(count, i + chunkSize));
+        std::shared_ptr<CompilationDatabaseJob> job(new CompilationDatabaseJob(path, chunk, extraCompilerFlags));
+        mThreadPool->start(job, Job::Priority);
+    }
+}
+
+void Server::onCompilationDatabaseParsed(const Path &path, const List<GccArguments> &args)
+{
+    Map<Path, PendingCompilationDatabase>::iterator pending = mPendingCompilationDatabases.find(path);
+    if (pending == mPendingCompilationDatabases.end())
+        return;
+    const int count = args.size();
+    for (int i=0; i<count; ++i) {
+        const GccArguments &arg = args.at(i);
+        if (arg.type() == GccArguments::NoType || arg.lang() == GccArguments::NoLang)
+            continue;
+        processSourceFile(arg, path, &pending->second.sources);
+        const List<Path> inputFiles = arg.inputFiles();
+        for (List<Path>::const_iterator it = inputFiles.begin(); it != inputFiles.end(); ++it)
+            pending->second.seen.insert(Location::insertFile(*it));
+    }
+    if (--pending->second.jobs)
+        return;
+
+    std::shared_ptr<Project> project = mProjects.value(path);
+    const int removed = project ? project->indexer->pruneSources(pending->second.seen) : 0;
+    if (Connection *conn = pending->second.connection) {
+        conn->write<128>("Parsed %s, %d sources changed, %d removed in %dms",
+                         path.constData(), pending->second.sources, removed, pending->second.timer.elapsed());
+        conn->finish();
+    }
+    mPendingCompilationDatabases.erase(pending);
+    if (project) {
+        assert(project->indexer);
+        project->indexer->endMakefile();
+    }
+}
+
+bool Server::sendSharedMemory(Connection *conn, const std::weak_ptr<Job> &job, const ByteArray &out)
+{
+    const int threshold = mOptions.sharedMemoryThreshold;
+    if (threshold <= 0 || out.size() < threshold)
+        return false;
+    std::shared_ptr<SharedMemory> memory;
+    unsigned int best = UINT_MAX;
+    int index = -1;
+    for (int i=0; i<mSharedMemoryPool.size(); ++i) {
+        const unsigned int size = mSharedMemoryPool.at(i)->size();
+        if (size >= static_cast<unsigned int>(out.size()) && size < best) {
+            best = size;
+            index = i;
+        }
+    }
+    if (index != -1) {
+        memory = mSharedMemoryPool.at(index);
+        mSharedMemoryPool.removeAt(index);
+    } else {
+        unsigned int size = 64 * 1024;
+        while (size < static_cast<unsigned int>(out.size()))
+            size *= 2;
+        memory.reset(new SharedMemory(IPC_PRIVATE, size, SharedMemory::Create));
+    }
+    void *data = memory->isValid() ? memory->attach(SharedMemory::Write) : 0;
+    if (!data) {
+        warning() << "Can't create shared memory segment of" << out.size() << "bytes, using the socket";
+        return false;
+    }
+    memcpy(data, out.constData(), out.size());
+    const SharedMemoryMessage msg(memory->id(), out.size());
+    if (!conn->send(&msg))
+        return false;
+    SharedOutput &shared = mSharedOutput[conn][memory->id()];
+    shared.memory = memory;
+    shared.job = job;
+    shared.size = out.size();
+    return true;
+}
+
+void Server::handleSharedMemoryMessage(SharedMemoryMessage *message, Connection *conn)
+{
+    Map<Connection*, Map<int, SharedOutput> >::iterator it = mSharedOutput.find(conn);
+    if (it == mSharedOutput.end())
+        return;
+    SharedOutput shared;
+    if (!it->second.remove(message->id(), &shared)) {
+        error("Unknown shared memory segment %d", message->id());
+        return;
+    }
+    if (std::shared_ptr<Job> job = shared.job.lock())
+        job->outputWritten(shared.size);
+#ifdef OS_Linux
+    // the client has marked the segment for removal, only Linux lets the
+    // next client attach it anyway
+    if (mSharedMemoryPool.size() < SharedMemoryPoolSize && shared.memory->size() <= MaxPooledSharedMemory)
+        mSharedMemoryPool.append(shared.memory);
+#endif
+    if (it->second.isEmpty()) {
+        mSharedOutput.erase(it);
+        if (mPendingFinish.remove(conn))
+            conn->finish();
+    }
+}
+
 void Server::handleCreateOutputMessage(CreateOutputMessage *message, Connection *conn)
 {
     LogObject *obj = new LogObject(conn, message->level());
@@ -309,6 +534,10 @@ void Server::handleQueryMessage(QueryMessage *message, Connection *conn)
     if (message->flags() & QueryMessage::Silent)
         conn->setSilent(true);
 
+    CachedLookup cached;
+    if (ResultCache::isCacheable(*message) && sendCachedResult(*message, conn, cached))
+        return;
+
     switch (message->type()) {
     case QueryMessage::Invalid:
         assert(0);
@@ -338,25 +567,25 @@ void Server::handleQueryMessage(QueryMessage *message, Connection *conn)
         errors(*message, conn);
         break;
     case QueryMessage::CursorInfo:
-        cursorInfo(*message, conn);
+        cursorInfo(*message, conn, cached);
         break;
     case QueryMessage::Shutdown:
         shutdown(*message, conn);
         break;
     case QueryMessage::FollowLocation:
-        followLocation(*message, conn);
+        followLocation(*message, conn, cached);
         break;
     case QueryMessage::ReferencesLocation:
-        referencesForLocation(*message, conn);
+        referencesForLocation(*message, conn, cached);
         break;
     case QueryMessage::ReferencesName:
-        referencesForName(*message, conn);
+        referencesForName(*message, conn, cached);
         break;
     case QueryMessage::ListSymbols:
-        listSymbols(*message, conn);
+        listSymbols(*message, conn, cached);
         break;
     case QueryMessage::FindSymbols:
-        findSymbols(*message, conn);
+        findSymbols(*message, conn, cached);
         break;
     case QueryMessage::Status:
         status(*message, conn);
@@ -370,6 +599,77 @@ void Server::handleQueryMessage(QueryMessage *message, Connection *conn)
     case QueryMessage::PreprocessFile:
         preprocessFile(*message, conn);
         break;
+    case QueryMessage::UnsavedFiles:
+        unsavedFiles(*message, conn);
+        break;
+    case QueryMessage::ClearUnsavedFile:
+        clearUnsavedFile(*message, conn);
+        break;
+    case QueryMessage::CodeComplete:
+        completions(*message, conn);
+        break;
+    case QueryMessage::Batch:
+        batch(*message, conn);
+        break;
+    }
+}
+
+bool Server::sendCachedResult(const QueryMessage &query, Connection *conn, CachedLookup &cached)
+{
+    // pick the project the same way the query would
+    switch (query.type()) {
+    case QueryMessage::FollowLocation:
+    case QueryMessage::ReferencesLocation:
+    case QueryMessage::CursorInfo: {
+        const Location loc = query.location();
+        if (loc.isNull())
+            return false;
+        updateProjectForLocation(loc);
+        break; }
+    default:
+        break;
+    }
+    std::shared_ptr<Project> project = currentProject();
+    if (!project)
+        return false;
+
+    const ByteArray key = ResultCache::key(query, project->srcRoot);
+    const uint64_t generation = project->generation();
+    List<ResultCache::Output> output;
+    if (!mResultCache.find(key, generation, output)) {
+        cached.key = key;
+        cached.generation = generation;
+        cached.project = project;
+        return false;
+    }
+    for (int i=0; i<output.size(); ++i)
+        conn->send(output.at(i).messageId, output.at(i).data);
+    conn->finish();
+    return true;
+}
+
+void Server::cacheOutput(const JobOutputEvent *e)
+{
+    Map<int, CachedLookup>::iterator it = mCachedLookups.find(e->id);
+    if (it == mCachedLookups.end())
+        return;
+    CachedLookup &cached = it->second;
+    if (!e->out.isEmpty()) {
+        cached.bytes += e->out.size();
+        if (cached.bytes > ResultCache::MaxEntryBytes) {
+            mCachedLookups.erase(it);
+            return;
+        }
+        const ResultCache::Output output = { e->messageId, e->out };
+        cached.output.append(output);
+    }
+    if (e->finish) {
+        // anything written to the maps since the query started might or
+        // might not be in the output
+        std::shared_ptr<Project> project = cached.project.lock();
+        if (project && project->generation() == cached.generation)
+            mResultCache.insert(cached.key, cached.generation, cached.output);
+        mCachedLookups.erase(it);
     }
 }
 
@@ -381,7 +681,7 @@ int Server::nextId()
     return mJobId;
 }
 
-void Server::followLocation(const QueryMessage &query, Connection *conn)
+void Server::followLocation(const QueryMessage &query, Connection *conn, const CachedLookup &cached)
 {
     const Location loc = query.location();
     if (loc.isNull()) {
@@ -400,7 +700,7 @@ void Server::followLocation(const QueryMessage &query, Connection *conn)
     std::shared_ptr<FollowLocationJob> job(new FollowLocationJob(loc, query, project));
     job->setId(nextId());
     mPendingLookups[job->id()] = conn;
-    startJob(job);
+    startJob(job, cached);
 }
 
 void Server::findFile(const QueryMessage &query, Connection *conn)
@@ -437,19 +737,19 @@ void Server::dumpFile(const QueryMessage &query, Connection *conn)
         return;
     }
     const SourceInformation c = project->indexer->sourceInfo(fileId);
-    if (c.args.isEmpty()) {
+    if (c.args().isEmpty()) {
         conn->write<256>("%s is not indexed", query.query().constData());
         conn->finish();
         return;
     }
 
-    std::shared_ptr<IndexerJob> job(new IndexerJob(query, project, c.sourceFile, c.args));
+    std::shared_ptr<IndexerJob> job(new IndexerJob(query, project, c.sourceFile, c.args()));
     job->setId(nextId());
     mPendingLookups[job->id()] = conn;
     startJob(job);
 }
 
-void Server::cursorInfo(const QueryMessage &query, Connection *conn)
+void Server::cursorInfo(const QueryMessage &query, Connection *conn, const CachedLookup &cached)
 {
     const Location loc = query.location();
     if (loc.isNull()) {
@@ -467,11 +767,11 @@ void Server::cursorInfo(const QueryMessage &query, Connection *conn)
     std::shared_ptr<CursorInfoJob> job(new CursorInfoJob(loc, query, project));
     job->setId(nextId());
     mPendingLookups[job->id()] = conn;
-    startJob(job);
+    startJob(job, cached);
 }
 
 
-void Server::referencesForLocation(const QueryMessage &query, Connection *conn)
+void Server::referencesForLocation(const QueryMessage &query, Connection *conn, const CachedLookup &cached)
 {
     const Location loc = query.location();
     if (loc.isNull()) {
@@ -490,10 +790,10 @@ void Server::referencesForLocation(const QueryMessage &query, Connection *conn)
     std::shared_ptr<ReferencesJob> job(new ReferencesJob(loc, query, project));
     job->setId(nextId());
     mPendingLookups[job->id()] = conn;
-    startJob(job);
+    startJob(job, cached);
 }
 
-void Server::referencesForName(const QueryMessage& query, Connection *conn)
+void Server::referencesForName(const QueryMessage& query, Connection *conn, const CachedLookup &cached)
 {
     const ByteArray name = query.query();
 
@@ -507,10 +807,10 @@ void Server::referencesForName(const QueryMessage& query, Connection *conn)
     std::shared_ptr<ReferencesJob> job(new ReferencesJob(name, query, project));
     job->setId(nextId());
     mPendingLookups[job->id()] = conn;
-    startJob(job);
+    startJob(job, cached);
 }
 
-void Server::findSymbols(const QueryMessage &query, Connection *conn)
+void Server::findSymbols(const QueryMessage &query, Connection *conn, const CachedLookup &cached)
 {
     const ByteArray partial = query.query();
 
@@ -524,10 +824,79 @@ void Server::findSymbols(const QueryMessage &query, Connection *conn)
     std::shared_ptr<FindSymbolsJob> job(new FindSymbolsJob(query, project));
     job->setId(nextId());
     mPendingLookups[job->id()] = conn;
+    startJob(job, cached);
+}
+
+void Server::batch(const QueryMessage &query, Connection *conn)
+{
+    const List<QueryMessage> queries = query.batch();
+    const int count = queries.size();
+    // the first location picks the project, the whole batch runs against it
+    bool updated = false;
+    for (int i=0; i<count; ++i) {
+        const QueryMessage &q = queries.at(i);
+        if (!QueryMessage::isBatchable(q.type())) {
+            conn->write<128>("Query %d (type %d) can't be batched", i, q.type());
+            conn->finish();
+            return;
+        }
+        switch (q.type()) {
+        case QueryMessage::FollowLocation:
+        case QueryMessage::ReferencesLocation:
+        case QueryMessage::CursorInfo:
+            if (!updated) {
+                const Location loc = q.location();
+                if (!loc.isNull())
+                    updated = updateProjectForLocation(loc);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    std::shared_ptr<Project> project = currentProject();
+    if (!project) {
+        error("No project");
+        conn->finish();
+        return;
+    }
+
+    std::shared_ptr<BatchJob> job(new BatchJob(query, project));
+    for (int i=0; i<count; ++i) {
+        const QueryMessage &q = queries.at(i);
+        std::shared_ptr<Job> sub;
+        switch (q.type()) {
+        case QueryMessage::FollowLocation:
+            sub.reset(new FollowLocationJob(q.location(), q, project));
+            break;
+        case QueryMessage::ReferencesLocation:
+            sub.reset(new ReferencesJob(q.location(), q, project));
+            break;
+        case QueryMessage::ReferencesName:
+            sub.reset(new ReferencesJob(q.query(), q, project));
+            break;
+        case QueryMessage::CursorInfo:
+            sub.reset(new CursorInfoJob(q.location(), q, project));
+            break;
+        case QueryMessage::FindSymbols:
+            sub.reset(new FindSymbolsJob(q, project));
+            break;
+        case QueryMessage::ListSymbols:
+            sub.reset(new ListSymbolsJob(q, project));
+            break;
+        default:
+            assert(0);
+            break;
+        }
+        job->addJob(sub);
+    }
+    job->setId(nextId());
+    mPendingLookups[job->id()] = conn;
     startJob(job);
 }
 
-void Server::listSymbols(const QueryMessage &query, Connection *conn)
+void Server::listSymbols(const QueryMessage &query, Connection *conn, const CachedLookup &cached)
 {
     const ByteArray partial = query.query();
 
@@ -541,7 +910,7 @@ void Server::listSymbols(const QueryMessage &query, Connection *conn)
     std::shared_ptr<ListSymbolsJob> job(new ListSymbolsJob(query, project));
     job->setId(nextId());
     mPendingLookups[job->id()] = conn;
-    startJob(job);
+    startJob(job, cached);
 }
 
 void Server::status(const QueryMessage &query, Connection *conn)
@@ -553,7 +922,7 @@ void Server::status(const QueryMessage &query, Connection *conn)
         return;
     }
 
-    std::shared_ptr<StatusJob> job(new StatusJob(query, project));
+    std::shared_ptr<StatusJob> job(new StatusJob(query, project, mResultCache.format()));
     job->setId(nextId());
     mPendingLookups[job->id()] = conn;
     startJob(job);
@@ -612,7 +981,7 @@ void Server::preprocessFile(const QueryMessage &query, Connection *conn)
 
     const uint32_t fileId = Location::fileId(path);
     const SourceInformation c = project->indexer->sourceInfo(fileId);
-    if (c.args.isEmpty()) {
+    if (c.args().isEmpty()) {
         conn->write("No arguments for " + path);
         conn->finish();
         return;
@@ -654,6 +1023,8 @@ void Server::errors(const QueryMessage &query, Connection *conn)
 void Server::clearProjects()
 {
     mProjects.clear();
+    ++mProjectsVersion;
+    mResultCache.clear();
     RTags::removeDirectory(mOptions.dataDir);
     writeProjects();
 }
@@ -677,22 +1048,97 @@ void Server::reindex(const QueryMessage &query, Connection *conn)
     conn->finish();
 }
 
-void Server::remake(const ByteArray &pattern, Connection *conn)
+void Server::unsavedFiles(const QueryMessage &query, Connection *conn)
+{
+    const UnsavedFilesMap files = query.unsavedFiles();
+    for (UnsavedFilesMap::const_iterator it = files.begin(); it != files.end(); ++it) {
+        updateProjectForLocation(it->first);
+        std::shared_ptr<Project> project = currentProject();
+        if (!project || !project->indexer || !project->indexer->setUnsavedFile(it->first, it->second))
+            conn->write<256>("%s is not indexed", it->first.constData());
+    }
+    conn->finish();
+}
+
+void Server::clearUnsavedFile(const QueryMessage &query, Connection *conn)
+{
+    const Path path = query.query();
+    updateProjectForLocation(path);
+    std::shared_ptr<Project> project = currentProject();
+    if (project && project->indexer)
+        project->indexer->clearUnsavedFile(path);
+    conn->finish();
+}
+
+void Server::completions(const QueryMessage &query, Connection *conn)
+{
+    const Location loc = query.location();
+    if (loc.isNull()) {
+        conn->finish();
+        return;
+    }
+    updateProjectForLocation(loc);
+
+    std::shared_ptr<Project> project = currentProject();
+    if (!project || !project->indexer) {
+        error("No project");
+        conn->finish();
+        return;
+    }
+
+    SourceInformation source = project->indexer->sourceInfo(loc.fileId());
+    if (source.args().isEmpty()) {
+        // a header, complete in the context of a source file that includes it
+        const Set<uint32_t> deps = project->indexer->dependencies(loc.fileId());
+        for (Set<uint32_t>::const_iterator it = deps.begin(); it != deps.end() && source.args().isEmpty(); ++it)
+            source = project->indexer->sourceInfo(*it);
+    }
+    if (source.args().isEmpty()) {
+        conn->write<256>("%s is not indexed", loc.path().constData());
+        conn->finish();
+        return;
+    }
+
+    UnsavedFilesMap unsavedFiles = project->indexer->unsavedFiles();
+    unsavedFiles.unite(query.unsavedFiles());
+
+    std::shared_ptr<CompletionJob> job(new CompletionJob(loc, query, project, source, unsavedFiles));
+    job->setId(nextId());
+    mPendingLookups[job->id()] = conn;
+    startJob(job);
+}
+
+void Server::remake(const ByteArray &pattern, Connection *conn, bool useCache)
 {
     // error() << "remake " << pattern;
     RegExp rx(pattern);
     for (Map<Path, MakefileInformation>::const_iterator it = mMakefiles.begin(); it != mMakefiles.end(); ++it) {
         if (rx.isEmpty() || rx.indexIn(it->first) != -1) {
-            make(it->first, it->second.makefileArgs, it->second.extraCompilerFlags, conn);
+            make(it->first, it->second.makefileArgs, it->second.extraCompilerFlags, conn, useCache);
         }
     }
 }
 
 void Server::startJob(const std::shared_ptr<Job> &job)
 {
+    if (job->id() != -1) {
+        mJobs[job->id()] = job;
+        const Connection *conn = mPendingLookups.value(job->id());
+        if (conn && conn->requestId())
+            mRequestIds[job->id()] = conn->requestId();
+        if (job->queryFlags() & QueryMessage::SharedMemory)
+            mSharedMemoryJobs.insert(job->id());
+    }
     mThreadPool->start(job, Job::Priority);
 }
 
+void Server::startJob(const std::shared_ptr<Job> &job, const CachedLookup &cached)
+{
+    if (!cached.key.isEmpty() && job->id() != -1)
+        mCachedLookups[job->id()] = cached;
+    startJob(job);
+}
+
 /* Same behavior as rtags-default-current-project() */
 
 enum FindAncestorFlag {
@@ -819,7 +1265,7 @@ void Server::onFileReady(const GccArguments &args, MakefileParser *parser)
         parser->stop();
 }
 
-bool Server::processSourceFile(const GccArguments &args, const Path &proj)
+bool Server::processSourceFile(const GccArguments &args, const Path &proj, int *indexed)
 {
     const List<Path> inputFiles = args.inputFiles();
     const int count = inputFiles.size();
@@ -840,6 +1286,7 @@ bool Server::processSourceFile(const GccArguments &args, const Path &proj)
             return false;
         }
         project.reset(new Project(srcRoot));
+        ++mProjectsVersion;
         project->indexer.reset(new Indexer(project, !(mOptions.options & NoValidate)));
         project->indexer->jobsComplete().connectAsync(this, &Server::onJobsComplete);
         project->indexer->jobStarted().connectAsync(this, &Server::onJobStarted);
@@ -881,6 +1328,8 @@ bool Server::processSourceFile(const GccArguments &args, const Path &proj)
         const SourceInformation existing = project->indexer->sourceInfo(Location::insertFile(c.sourceFile));
         if (existing != c) {
             project->indexer->index(c, IndexerJob::Makefile);
+            if (indexed)
+                ++*indexed;
         } else {
             debug() << c.sourceFile << " is not dirty. ignoring";
         }
@@ -898,30 +1347,63 @@ void Server::event(const Event *event)
     switch (event->type()) {
     case JobOutputEvent::Type: {
         const JobOutputEvent *e = static_cast<const JobOutputEvent*>(event);
+        if (e->finish)
+            mJobs.remove(e->id);
         Map<int, Connection*>::iterator it = mPendingLookups.find(e->id);
-        if (it == mPendingLookups.end()) {
+        if (it == mPendingLookups.end() || !it->second->isConnected()) {
+            mCachedLookups.remove(e->id);
+            mSharedMemoryJobs.remove(e->id);
             if (std::shared_ptr<Job> job = e->job.lock())
                 job->abort();
             break;
         }
-        if (!it->second->isConnected()) {
-            if (std::shared_ptr<Job> job = e->job.lock())
-                job->abort();
-            break;
-        }
-        if (!e->out.isEmpty() && !it->second->write(e->out)) {
-            if (std::shared_ptr<Job> job = e->job.lock())
-                job->abort();
-            break;
+        Connection *conn = it->second;
+        const int requestId = mRequestIds.value(e->id);
+        conn->setRequestId(requestId);
+        if (!e->out.isEmpty()) {
+            if (e->messageId == ResponseMessage::MessageId && mSharedMemoryJobs.contains(e->id)
+                && sendSharedMemory(conn, e->job, e->out)) {
+                // credited back to the job when the client releases the segment
+            } else if (!conn->send(e->messageId, e->out)) {
+                conn->setRequestId(0);
+                mCachedLookups.remove(e->id);
+                if (std::shared_ptr<Job> job = e->job.lock())
+                    job->abort();
+                break;
+            } else if (!e->finish) {
+                if (std::shared_ptr<Job> job = e->job.lock()) {
+                    // hold the job back until the client has read some of this
+                    if (conn->pendingWrite() > Job::LowWaterMark) {
+                        mPendingOutput[conn].append(std::make_pair(e->job, e->out.size()));
+                    } else {
+                        job->outputWritten(e->out.size());
+                    }
+                }
+            }
         }
+        cacheOutput(e);
 
         if (e->finish) {
-            it->second->finish();
+            // closing the connection now would take the segments with it,
+            // persistent connections stay open
+            if (!requestId && mSharedOutput.contains(conn)) {
+                mPendingFinish.insert(conn);
+            } else {
+                conn->finish();
+            }
+            mRequestIds.remove(e->id);
+            mSharedMemoryJobs.remove(e->id);
+            mPendingLookups.erase(it);
         }
+        conn->setRequestId(0);
         break; }
     case MakefileParserDoneEvent::Type: {
         delete static_cast<const MakefileParserDoneEvent*>(event)->parser;
         break; }
+    case CompilationDatabaseEvent::Type: {
+        const CompilationDatabaseEvent *e = static_cast<const CompilationDatabaseEvent*>(event);
+        onCompilationDatabaseParsed(e->path, e->args);
+        break; }
     default:
         EventReceiver::event(event);
         break;
@@ -1018,6 +1500,7 @@ void Server::removeProject(const Path &path)
         writeProjects();
 
     mProjects.remove(path);
+    ++mProjectsVersion;
 
     if (!mCurrentProject.lock() && !mProjects.isEmpty())
         setCurrentProject(mProjects.begin()->first);
@@ -1092,6 +1575,7 @@ bool Server::smartProject(const Path &path, const List<ByteArray> &extraCompiler
         return false;
     std::shared_ptr<Project> &project = mProjects[path];
     project.reset(new Project(path));
+    ++mProjectsVersion;
     project->indexer.reset(new Indexer(project, !(mOptions.options & NoValidate)));
     project->indexer->jobsComplete().connectAsync(this, &Server::onJobsComplete);
     project->indexer->jobStarted().connectAsync(this, &Server::onJobStarted);
@@ -1134,6 +1618,7 @@ void Server::deleteProject(const QueryMessage &query, Connection *conn)
         conn->write<128>("Erased project: %s", path.constData());
         RTags::encodePath(path);
         Path::rm(mOptions.dataDir + path);
+        Path::rm(makefileCachePath(*it));
         removeProject(*it);
     }
     conn->finish();
@@ -1148,12 +1633,22 @@ void Server::project(const QueryMessage &query, Connection *conn)
                              it->second == current ? " <=" : "");
         }
     } else {
+        ConnectionState *state = conn->requestId() ? &mConnectionStates[conn] : 0;
+        if (state && state->projectQuery == query.query() && state->projectsVersion == mProjectsVersion) {
+            if (std::shared_ptr<Project> project = state->project.lock()) {
+                setCurrentProject(project);
+                conn->write<128>("Selected project: %s", project->srcRoot.constData());
+                conn->finish();
+                return;
+            }
+        }
         std::shared_ptr<Project> selected;
         bool error = false;
         const Path path = query.query();
         Path key;
         if (path.exists() && updateProjectForLocation(path, &key)) {
             conn->write<128>("Selected project: %s", key.constData());
+            selected = currentProject();
         } else {
             RegExp rx(query.query());
             for (ProjectsMap::const_iterator it = mProjects.begin(); it != mProjects.end(); ++it) {
@@ -1183,6 +1678,11 @@ void Server::project(const QueryMessage &query, Connection *conn)
                 conn->write<128>("No matches for %s", query.query().constData());
             }
         }
+        if (state && selected) {
+            state->projectQuery = query.query();
+            state->project = selected;
+            state->projectsVersion = mProjectsVersion;
+        }
     }
     conn->finish();
 }
@@ -15,6 +15,8 @@
 #include "Project.h"
 #include "GRScanJob.h"
 #include "MakefileInformation.h"
+#include "ResultCache.h"
+#include "SharedMemory.h"
 
 class GRTagsMessage;
 class Connection;
@@ -23,10 +25,12 @@ class Message;
 class ErrorMessage;
 class OutputMessage;
 class ProjectMessage;
+class SharedMemoryMessage;
 class LocalServer;
 class GccArguments;
 class MakefileParser;
 class Job;
+class JobOutputEvent;
 class Server : public EventReceiver
 {
 public:
@@ -38,21 +42,36 @@ public:
         NoClangIncludePath = 0x1,
         NoValidate = 0x2,
         ClearProjects = 0x4,
-        NoWall = 0x8
+        NoWall = 0x8,
+        UseIndexAPI = 0x10
     };
+    enum { DefaultSharedMemoryThreshold = 512 * 1024 };
     ThreadPool *threadPool() const { return mThreadPool; }
     void startJob(const std::shared_ptr<Job> &job);
     struct Options {
-        Options() : options(0), threadCount(0) {}
+        Options() : options(0), threadCount(0), sharedMemoryThreshold(DefaultSharedMemoryThreshold) {}
         Path projectsFile, socketFile, dataDir;
         unsigned options;
         int threadCount;
+        int sharedMemoryThreshold; // 0 to always use the socket
         List<ByteArray> defaultArguments, excludeFilter;
     };
     bool init(const Options &options);
+    unsigned options() const { return mOptions.options; }
     const List<ByteArray> &excludeFilter() const { return mOptions.excludeFilter; }
     const Path &clangPath() const { return mClangPath; }
 private:
+    // a cacheable query that missed the cache, set up by sendCachedResult
+    // and attached to the query's job by startJob
+    struct CachedLookup {
+        CachedLookup() : generation(0), bytes(0) {}
+        ByteArray key;
+        uint64_t generation;
+        std::weak_ptr<Project> project;
+        List<ResultCache::Output> output;
+        int bytes;
+    };
+    void startJob(const std::shared_ptr<Job> &job, const CachedLookup &cached);
     void onJobsComplete(std::shared_ptr<Indexer> indexer, int count);
     void onJobStarted(std::shared_ptr<Indexer> indexer, Path path);
 
@@ -66,28 +85,39 @@ private:
     std::shared_ptr<Project> setCurrentProject(const std::shared_ptr<Project> &proj);
     void event(const Event *event);
     void onFileReady(const GccArguments &file, MakefileParser *parser);
-    bool processSourceFile(const GccArguments &args, const Path &makefile);
+    bool processSourceFile(const GccArguments &args, const Path &makefile, int *indexed = 0);
     void onNewMessage(Message *message, Connection *conn);
     void onConnectionDestroyed(Connection *o);
+    void onConnectionClosed(Connection *o);
+    void onConnectionBytesWritten(Connection *o, int bytes);
+    void abortJobs(Connection *o);
     void onMakefileParserDone(MakefileParser *parser);
     void onMakefileModified(const Path &path);
+    Path makefileCachePath(const Path &makefile) const;
     void onMakefileRemoved(const Path &path);
+    void loadCompilationDatabase(const Path &path, const List<ByteArray> &extraCompilerFlags, Connection *conn);
+    void onCompilationDatabaseParsed(const Path &path, const List<GccArguments> &args);
     void make(const Path &path, const List<ByteArray> &makefileArgs = List<ByteArray>(),
               const List<ByteArray> &extraCompilerFlags = List<ByteArray>(),
-              Connection *conn = 0);
+              Connection *conn = 0, bool useCache = false);
     void clearProjects();
     void handleProjectMessage(ProjectMessage *message, Connection *conn);
     void handleQueryMessage(QueryMessage *message, Connection *conn);
+    bool sendCachedResult(const QueryMessage &query, Connection *conn, CachedLookup &cached);
+    void cacheOutput(const JobOutputEvent *e);
     void handleErrorMessage(ErrorMessage *message, Connection *conn);
     void handleCreateOutputMessage(CreateOutputMessage *message, Connection *conn);
+    void handleSharedMemoryMessage(SharedMemoryMessage *message, Connection *conn);
+    bool sendSharedMemory(Connection *conn, const std::weak_ptr<Job> &job, const ByteArray &out);
     void fixIts(const QueryMessage &query, Connection *conn);
     void errors(const QueryMessage &query, Connection *conn);
-    void followLocation(const QueryMessage &query, Connection *conn);
-    void cursorInfo(const QueryMessage &query, Connection *conn);
-    void referencesForLocation(const QueryMessage &query, Connection *conn);
-    void referencesForName(const QueryMessage &query, Connection *conn);
-    void findSymbols(const QueryMessage &query, Connection *conn);
-    void listSymbols(const QueryMessage &query, Connection *conn);
+    void followLocation(const QueryMessage &query, Connection *conn, const CachedLookup &cached);
+    void cursorInfo(const QueryMessage &query, Connection *conn, const CachedLookup &cached);
+    void referencesForLocation(const QueryMessage &query, Connection *conn, const CachedLookup &cached);
+    void referencesForName(const QueryMessage &query, Connection *conn, const CachedLookup &cached);
+    void findSymbols(const QueryMessage &query, Connection *conn, const CachedLookup &cached);
+    void listSymbols(const QueryMessage &query, Connection *conn, const CachedLookup &cached);
+    void batch(const QueryMessage &query, Connection *conn);
     void status(const QueryMessage &query, Connection *conn);
     void isIndexed(const QueryMessage &query, Connection *conn);
     void hasFileManager(const QueryMessage &query, Connection *conn);
@@ -100,8 +130,10 @@ private:
     void shutdown(const QueryMessage &query, Connection *conn);
     int nextId();
     void reindex(const QueryMessage &query, Connection *conn);
-    void remake(const ByteArray &pattern = ByteArray(), Connection *conn = 0);
-    ByteArray completions(const QueryMessage &query);
+    void unsavedFiles(const QueryMessage &query, Connection *conn);
+    void clearUnsavedFile(const QueryMessage &query, Connection *conn);
+    void remake(const ByteArray &pattern = ByteArray(), Connection *conn = 0, bool useCache = false);
+    void completions(const QueryMessage &query, Connection *conn);
     bool updateProjectForLocation(const Location &location);
     bool updateProjectForLocation(const Path &path, Path *key = 0);
     void writeProjects();
@@ -114,6 +146,42 @@ private:
     Options mOptions;
     LocalServer *mServer;
     Map<int, Connection*> mPendingLookups;
+    // request ids of jobs started for rc --server, their output is tagged
+    // with it and the connection stays open when they're done
+    Map<int, int> mRequestIds;
+    // what a persistent connection asked for last, rc --server repeats
+    // --project with every request
+    struct ConnectionState {
+        ConnectionState() : projectsVersion(0) {}
+        ByteArray projectQuery;
+        std::weak_ptr<Project> project;
+        int projectsVersion;
+    };
+    Map<Connection*, ConnectionState> mConnectionStates;
+    // bumped when projects are added or removed
+    int mProjectsVersion;
+    Map<int, std::weak_ptr<Job> > mJobs;
+    // job output queued on connections that are above Job::LowWaterMark,
+    // credited back to the jobs once the connection catches up
+    Map<Connection*, List<std::pair<std::weak_ptr<Job>, int> > > mPendingOutput;
+    // responses handed to the client in shared memory, by segment id. The
+    // connection isn't finished until the client has sent them all back.
+    struct SharedOutput {
+        std::shared_ptr<SharedMemory> memory;
+        std::weak_ptr<Job> job;
+        int size;
+    };
+    Map<Connection*, Map<int, SharedOutput> > mSharedOutput;
+    // jobs whose client asked for shared memory (rc --shared-memory)
+    Set<int> mSharedMemoryJobs;
+    Set<Connection*> mPendingFinish;
+    ResultCache mResultCache;
+    // output of cacheable queries collected as it's sent, by job id
+    Map<int, CachedLookup> mCachedLookups;
+    // segments the clients are done with, still attached. Faulting in fresh
+    // segments costs more than the socket would.
+    enum { SharedMemoryPoolSize = 4, MaxPooledSharedMemory = 4 * 1024 * 1024 };
+    List<std::shared_ptr<SharedMemory> > mSharedMemoryPool;
     bool mVerbose;
     int mJobId;
     Map<Path, MakefileInformation> mMakefiles;
@@ -121,6 +189,14 @@ private:
     Map<Path, List<ByteArray> > mSmartProjects;
     FileSystemWatcher mMakefilesWatcher;
 
+    struct PendingCompilationDatabase {
+        int jobs, sources;
+        Set<uint32_t> seen; // every source in the database, the rest are pruned
+        Connection *connection;
+        Timer timer;
+    };
+    Map<Path, PendingCompilationDatabase> mPendingCompilationDatabases;
+
     ProjectsMap mProjects;
     std::weak_ptr<Project> mCurrentProject;
     ThreadPool *mThreadPool;
@@ -129,7 +205,7 @@ private:
 
     Map<std::shared_ptr<Indexer>, int> mSaveTimers;
 
-    enum { DatabaseVersion = 1 };
+    enum { DatabaseVersion = 6 };
 };
 
 #endif
@@ -10,7 +10,7 @@
 SharedMemory::SharedMemory(int key, unsigned int size, CreateFlag flag)
     : mAddr(0)
 {
-    const int flg = (flag == Create) ? (IPC_CREAT | IPC_EXCL) : 0;
+    const int flg = (flag == Create) ? (IPC_CREAT | IPC_EXCL | 0600) : 0;
     mShm = shmget(key, size, flg);
     mOwner = ((flg & IPC_CREAT) == IPC_CREAT);
 }
@@ -21,11 +21,16 @@ SharedMemory::SharedMemory(const Path& filename, unsigned int size, CreateFlag f
     const key_t key = ftok(filename.nullTerminated(), PROJID);
     if (key == -1)
         return;
-    const int flg = (flag == Create) ? (IPC_CREAT | IPC_EXCL) : 0;
+    const int flg = (flag == Create) ? (IPC_CREAT | IPC_EXCL | 0600) : 0;
     mShm = shmget(key, size, flg);
     mOwner = ((flg & IPC_CREAT) == IPC_CREAT);
 }
 
+SharedMemory::SharedMemory(IdFlag, int id)
+    : mShm(id), mOwner(false), mAddr(0)
+{
+}
+
 SharedMemory::~SharedMemory()
 {
     if (mAddr) {
@@ -36,6 +41,14 @@ SharedMemory::~SharedMemory()
         shmctl(mShm, IPC_RMID, 0);
 }
 
+unsigned int SharedMemory::size() const
+{
+    shmid_ds ds;
+    if (mShm == -1 || shmctl(mShm, IPC_STAT, &ds) == -1)
+        return 0;
+    return ds.shm_segsz;
+}
+
 void* SharedMemory::attach(AttachFlag flag, void* address)
 {
     if (mAddr)
@@ -50,6 +63,14 @@ void* SharedMemory::attach(AttachFlag flag, void* address)
     return mAddr;
 }
 
+bool SharedMemory::remove()
+{
+    if (mShm == -1 || shmctl(mShm, IPC_RMID, 0) == -1)
+        return false;
+    mOwner = false;
+    return true;
+}
+
 void SharedMemory::detach()
 {
     if (!mAddr)
@@ -8,15 +8,22 @@ class SharedMemory
 public:
     enum CreateFlag { None, Create };
     enum AttachFlag { Read = 0x0, Write = 0x1, ReadWrite = Write };
+    enum IdFlag { Id };
 
     SharedMemory(int key, unsigned int size, CreateFlag = None);
     SharedMemory(const Path& filename, unsigned int size, CreateFlag = None);
+    // an existing segment by its id(), for segments created with IPC_PRIVATE
+    SharedMemory(IdFlag, int id);
     ~SharedMemory();
 
     void* attach(AttachFlag flag, void* address = 0);
     void detach();
+    // marks the segment for removal once the last process detaches
+    bool remove();
 
     bool isValid() const { return mShm != -1; }
+    int id() const { return mShm; }
+    unsigned int size() const;
 
 private:
     int mShm;
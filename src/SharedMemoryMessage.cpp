@@ -0,0 +1,18 @@
+#include "SharedMemoryMessage.h"
+#include "Serializer.h"
+
+ByteArray SharedMemoryMessage::encode() const
+{
+    ByteArray data;
+    {
+        Serializer stream(data);
+        stream << mRaw << mId << mSize;
+    }
+    return data;
+}
+
+void SharedMemoryMessage::fromData(const char *data, int size)
+{
+    Deserializer stream(data, size);
+    stream >> mRaw >> mId >> mSize;
+}
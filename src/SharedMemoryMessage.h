@@ -0,0 +1,30 @@
+#ifndef SharedMemoryMessage_h
+#define SharedMemoryMessage_h
+
+#include "ClientMessage.h"
+
+// Sent by rdm in place of a ResponseMessage that's too big for the socket.
+// The response is in the shared memory segment with the given id, the
+// client sends the message back once it's done with it so rdm can remove
+// the segment.
+class SharedMemoryMessage : public ClientMessage
+{
+public:
+    enum { MessageId = 8 };
+
+    SharedMemoryMessage(int id = -1, int size = 0)
+        : mId(id), mSize(size)
+    {}
+
+    virtual int messageId() const { return MessageId; }
+
+    int id() const { return mId; }
+    int size() const { return mSize; }
+
+    ByteArray encode() const;
+    void fromData(const char *data, int size);
+private:
+    int mId, mSize;
+};
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef SourceInformation_h
 #define SourceInformation_h
 
+#include "ArgumentsTable.h"
 #include "List.h"
 #include "ByteArray.h"
 #include "Path.h"
@@ -9,45 +10,36 @@ class SourceInformation
 {
 public:
     SourceInformation()
-        : parsed(0)
+        : argsId(0), parsed(0)
     {}
     SourceInformation(const Path &source, const List<ByteArray> &a, const Path &comp)
-        : sourceFile(source), args(a), compiler(comp), parsed(0)
+        : sourceFile(source), argsId(ArgumentsTable::insert(a)), compiler(comp), parsed(0)
     {}
 
+    const List<ByteArray> &args() const { return ArgumentsTable::arguments(argsId); }
+    void setArgs(const List<ByteArray> &a) { argsId = ArgumentsTable::insert(a); }
+
     Path sourceFile;
-    List<ByteArray> args;
+    uint32_t argsId; // interned, equal lists have equal ids
     Path compiler;
     time_t parsed;
     bool operator==(const SourceInformation &other) const
     {
         // We're intentionally not comparing parsed here
-        return (sourceFile == other.sourceFile && args == other.args && compiler == other.compiler);
+        return (sourceFile == other.sourceFile && argsId == other.argsId && compiler == other.compiler);
     }
     bool operator!=(const SourceInformation &other) const
     {
         // We're intentionally not comparing parsed here
-        return (sourceFile != other.sourceFile || args != other.args || compiler != other.compiler);
+        return (sourceFile != other.sourceFile || argsId != other.argsId || compiler != other.compiler);
     }
 };
 
-template <> inline Serializer &operator<<(Serializer &s, const SourceInformation &t)
-{
-    s << t.sourceFile << t.args << t.compiler << t.parsed;
-    return s;
-}
-
-template <> inline Deserializer &operator>>(Deserializer &s, SourceInformation &t)
-{
-    s >> t.sourceFile >> t.args >> t.compiler >> t.parsed;
-    return s;
-}
-
 static inline Log operator<<(Log dbg, const SourceInformation &s)
 {
     dbg << ByteArray::snprintf<256>("SourceInformation(%s %s %s ... %d)",
                                     s.compiler.constData(),
-                                    ByteArray::join(s.args, ' ').constData(),
+                                    ByteArray::join(s.args(), ' ').constData(),
                                     s.sourceFile.constData(),
                                     s.parsed);
     return dbg;
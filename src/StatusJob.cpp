@@ -6,15 +6,16 @@
 #include <clang-c/Index.h>
 
 const char *StatusJob::delimiter = "*********************************";
-StatusJob::StatusJob(const QueryMessage &q, const std::shared_ptr<Project> &project)
-    : Job(q, WriteUnfiltered|WriteBuffered, project), query(q.query())
+StatusJob::StatusJob(const QueryMessage &q, const std::shared_ptr<Project> &project,
+                     const List<ByteArray> &cache)
+    : Job(q, WriteUnfiltered|WriteBuffered, project), query(q.query()), resultCache(cache)
 {
 }
 
 void StatusJob::execute()
 {
     bool matched = false;
-    const char *alternatives = "fileids|dependencies|fileinfos|symbols|symbolnames"; //|grfiles|gr";
+    const char *alternatives = "fileids|dependencies|fileinfos|symbols|symbolnames|profile|cache"; //|grfiles|gr";
     if (query.isEmpty() || !strcasecmp(query.nullTerminated(), "fileids")) {
         matched = true;
         write(delimiter);
@@ -27,6 +28,15 @@ void StatusJob::execute()
             return;
     }
 
+    if (query.isEmpty() || !strcasecmp(query.nullTerminated(), "cache")) {
+        matched = true;
+        write(delimiter);
+        write("cache");
+        write(delimiter);
+        for (List<ByteArray>::const_iterator it = resultCache.begin(); it != resultCache.end(); ++it)
+            write(*it);
+    }
+
     std::shared_ptr<Project> proj = project();
     if (!proj) {
         if (!matched) {
@@ -108,9 +118,19 @@ void StatusJob::execute()
             write(delimiter);
             for (SourceInformationMap::const_iterator it = map.begin(); it != map.end(); ++it) {
                 write<512>("  %s: %s %s", Location::path(it->first).constData(), it->second.compiler.constData(),
-                           ByteArray::join(it->second.args, " ").constData());
+                           ByteArray::join(it->second.args(), " ").constData());
             }
         }
+
+        if (query.isEmpty() || !strcasecmp(query.nullTerminated(), "profile")) {
+            matched = true;
+            const List<ByteArray> lines = proj->indexer->profile();
+            write(delimiter);
+            write("profile");
+            write(delimiter);
+            for (List<ByteArray>::const_iterator it = lines.begin(); it != lines.end(); ++it)
+                write(*it);
+        }
     }
 
 //     if (query.isEmpty() || !strcasecmp(query.nullTerminated(), "grfiles")) {
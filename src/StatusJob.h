@@ -9,12 +9,14 @@ class QueryMessage;
 class StatusJob : public Job
 {
 public:
-    StatusJob(const QueryMessage &query, const std::shared_ptr<Project> &project);
+    StatusJob(const QueryMessage &query, const std::shared_ptr<Project> &project,
+              const List<ByteArray> &resultCache = List<ByteArray>());
     static const char *delimiter;
 protected:
     virtual void execute();
 private:
     const ByteArray query;
+    const List<ByteArray> resultCache;
 };
 
 #endif
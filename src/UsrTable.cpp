@@ -0,0 +1,84 @@
+#include "UsrTable.h"
+#include "RTags.h"
+
+uint64_t UsrTable::hash(const char *usr, int length)
+{
+    return RTags::hash(usr, length);
+}
+
+void UsrTable::insert(const Entry &entry)
+{
+    if (entry.location.isNull())
+        return;
+    mLocations[entry.kind][entry.usr].insert(entry.location);
+    mFiles[entry.location.fileId()].insert(entry.usr);
+}
+
+const Set<Location> &UsrTable::find(uint64_t usr, Kind kind) const
+{
+    static const Set<Location> empty;
+    const std::unordered_map<uint64_t, Set<Location> >::const_iterator it = mLocations[kind].find(usr);
+    return it == mLocations[kind].end() ? empty : it->second;
+}
+
+void UsrTable::dirty(const Set<uint32_t> &fileIds)
+{
+    for (Set<uint32_t>::const_iterator file = fileIds.begin(); file != fileIds.end(); ++file) {
+        const Map<uint32_t, Set<uint64_t> >::iterator usrs = mFiles.find(*file);
+        if (usrs == mFiles.end())
+            continue;
+        for (Set<uint64_t>::const_iterator usr = usrs->second.begin(); usr != usrs->second.end(); ++usr) {
+            for (int k=Declaration; k<=Definition; ++k) {
+                const std::unordered_map<uint64_t, Set<Location> >::iterator it = mLocations[k].find(*usr);
+                if (it == mLocations[k].end())
+                    continue;
+                Set<Location>::iterator loc = it->second.begin();
+                while (loc != it->second.end()) {
+                    if (loc->fileId() == *file) {
+                        it->second.erase(loc++);
+                    } else {
+                        ++loc;
+                    }
+                }
+                if (it->second.isEmpty())
+                    mLocations[k].erase(it);
+            }
+        }
+        mFiles.erase(usrs);
+    }
+}
+
+void UsrTable::clear()
+{
+    mLocations[Declaration].clear();
+    mLocations[Definition].clear();
+    mFiles.clear();
+}
+
+void UsrTable::save(Serializer &out) const
+{
+    for (int k=Declaration; k<=Definition; ++k) {
+        out << static_cast<int>(mLocations[k].size());
+        for (std::unordered_map<uint64_t, Set<Location> >::const_iterator it = mLocations[k].begin(); it != mLocations[k].end(); ++it)
+            out << it->first << it->second;
+    }
+}
+
+void UsrTable::restore(Deserializer &in)
+{
+    clear();
+    for (int k=Declaration; k<=Definition; ++k) {
+        int count;
+        in >> count;
+        for (int i=0; i<count; ++i) {
+            Entry entry;
+            Set<Location> locations;
+            in >> entry.usr >> locations;
+            entry.kind = static_cast<Kind>(k);
+            for (Set<Location>::const_iterator it = locations.begin(); it != locations.end(); ++it) {
+                entry.location = *it;
+                insert(entry);
+            }
+        }
+    }
+}
@@ -0,0 +1,42 @@
+#ifndef UsrTable_h
+#define UsrTable_h
+
+#include "Location.h"
+#include "Map.h"
+#include "Serializer.h"
+#include "Set.h"
+#include <unordered_map>
+
+// Project-wide USR -> location table, owned by the Indexer and only touched
+// from Indexer::write and when files are dirtied. Entries are keyed on a
+// 64-bit hash of the USR, jobs hand in the hashes they needed anyway
+// through IndexData::usrs.
+class UsrTable
+{
+public:
+    enum Kind {
+        Declaration,
+        Definition
+    };
+    struct Entry {
+        uint64_t usr;
+        Kind kind;
+        Location location;
+    };
+
+    static uint64_t hash(const char *usr, int length);
+
+    void insert(const Entry &entry);
+    const Set<Location> &find(uint64_t usr, Kind kind) const;
+    void dirty(const Set<uint32_t> &fileIds);
+    void clear();
+    int size() const { return mLocations[Declaration].size() + mLocations[Definition].size(); }
+
+    void save(Serializer &out) const;
+    void restore(Deserializer &in);
+private:
+    std::unordered_map<uint64_t, Set<Location> > mLocations[2];
+    Map<uint32_t, Set<uint64_t> > mFiles; // so dirty() only visits the entries of those files
+};
+
+#endif
@@ -21,7 +21,11 @@ public:
             timespec timeout;
             memset(&timeout, 0, sizeof(timespec));
             timeout.tv_sec = now.tv_sec + (maxTime / 1000);
-            timeout.tv_nsec = ((now.tv_usec * 1000) + maxTime % 1000) * 1000;
+            timeout.tv_nsec = (now.tv_usec * 1000) + ((maxTime % 1000) * 1000000);
+            if (timeout.tv_nsec >= 1000000000) {
+                ++timeout.tv_sec;
+                timeout.tv_nsec -= 1000000000;
+            }
             ret = pthread_cond_timedwait(&mCond, &mutex->mMutex, &timeout);
         } else {
             ret = pthread_cond_wait(&mCond, &mutex->mMutex);
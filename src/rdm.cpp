@@ -54,6 +54,7 @@ void usage(FILE *f)
             "  --no-Wall|-W                    Don't use -Wall\n"
             "  --silent|-S                     No logging to stdout\n"
             "  --no-validate|-V                Disable validation of database on startup and after indexing\n"
+            "  --use-index-api|-u              Index with clang_indexSourceFile callbacks instead of visiting the AST\n"
             "  --exclude-filter|-x [arg]       Files to exclude from grtags, default \"" EXCLUDEFILTER_DEFAULT "\"\n"
             "  --no-rc|-N                      Don't load any rc files\n"
             "  --rc-file|-c [arg]              Use this file instead of ~/.rdmrc\n"
@@ -61,7 +62,9 @@ void usage(FILE *f)
             "  --data-dir|-d [arg]             Use this directory to contains .rtags directory (default ~/)\n"
             "  --socket-file|-n [arg]          Use this file for the server socket (default ~/.rdm)\n"
             "  --setenv|-e [arg]               Set this environment variable (--setenv \"foobar=1\")\n"
-            "  --thread-count|-j [arg]         Spawn this many threads for thread pool\n");
+            "  --thread-count|-j [arg]         Spawn this many threads for thread pool\n"
+            "  --shared-memory-threshold|-m [arg] Send responses of at least this many bytes through shared memory\n"
+            "                                  to clients that pass --shared-memory, 0 to disable (default %d)\n", Server::DefaultSharedMemoryThreshold);
 }
 
 int main(int argc, char** argv)
@@ -84,12 +87,14 @@ int main(int argc, char** argv)
         { "enable-sighandler", no_argument, 0, 's' },
         { "silent", no_argument, 0, 'S' },
         { "no-validate", no_argument, 0, 'V' },
+        { "use-index-api", no_argument, 0, 'u' },
         { "exclude-filter", required_argument, 0, 'x' },
         { "socket-file", required_argument, 0, 'n' },
         { "projects-file", required_argument, 0, 'p' },
         { "rc-file", required_argument, 0, 'c' },
         { "no-rc", no_argument, 0, 'N' },
         { "data-dir", required_argument, 0, 'd' },
+        { "shared-memory-threshold", required_argument, 0, 'm' },
         { 0, 0, 0, 0 }
     };
     const ByteArray shortOptions = RTags::shortOptions(opts);
@@ -147,6 +152,7 @@ int main(int argc, char** argv)
     }
 
     int jobs = ThreadPool::idealThreadCount();
+    int sharedMemoryThreshold = Server::DefaultSharedMemoryThreshold;
     unsigned options = 0;
     List<ByteArray> defaultArguments;
     const char *excludeFilter = 0;
@@ -184,6 +190,9 @@ int main(int argc, char** argv)
         case 'V':
             options |= Server::NoValidate;
             break;
+        case 'u':
+            options |= Server::UseIndexAPI;
+            break;
         case 'e':
             putenv(optarg);
             break;
@@ -209,6 +218,14 @@ int main(int argc, char** argv)
                 return 1;
             }
             break;
+        case 'm': {
+            char *end;
+            sharedMemoryThreshold = strtol(optarg, &end, 10);
+            if (*end || sharedMemoryThreshold < 0) {
+                fprintf(stderr, "Can't parse argument to -m %s\n", optarg);
+                return 1;
+            }
+            break; }
         case 'D':
             defaultArguments.append("-D" + ByteArray(optarg));
             break;
@@ -262,6 +279,7 @@ int main(int argc, char** argv)
         serverOpts.dataDir.append('/');
     serverOpts.defaultArguments = defaultArguments;
     serverOpts.threadCount = jobs;
+    serverOpts.sharedMemoryThreshold = sharedMemoryThreshold;
     serverOpts.projectsFile = projectsFile;
     if (!server->init(serverOpts)) {
         delete server;
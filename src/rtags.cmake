@@ -8,6 +8,7 @@ include_directories(
 
 set(rtags_client_HDRS
     AbortInterface.h
+    ArgumentsTable.h
     ByteArray.h
     Client.h
     Connection.h
@@ -16,6 +17,7 @@ set(rtags_client_HDRS
     EventLoop.h
     EventReceiver.h
     FastDelegate.h
+    FinishMessage.h
     IniFile.h
     Job.h
     List.h
@@ -24,6 +26,7 @@ set(rtags_client_HDRS
     Log.h
     LogObject.h
     Map.h
+    LocationsMessage.h
     Message.h
     Messages.h
     Mutex.h
@@ -42,6 +45,7 @@ set(rtags_client_HDRS
     Serializer.h
     Set.h
     SharedMemory.h
+    SharedMemoryMessage.h
     SignalSlot.h
     SourceInformation.h
     ReadWriteLock.h
@@ -55,12 +59,14 @@ set(rtags_client_HDRS
    )
 
 set(rtags_client_SRCS
+    ArgumentsTable.cpp
     Client.cpp
     Connection.cpp
     CreateOutputMessage.cpp
     EventLoop.cpp
     LocalClient.cpp
     Location.cpp
+    LocationsMessage.cpp
     Log.cpp
     Messages.cpp
     Path.cpp
@@ -72,6 +78,7 @@ set(rtags_client_SRCS
     ReadWriteLock.cpp
     Semaphore.cpp
     SharedMemory.cpp
+    SharedMemoryMessage.cpp
     Thread.cpp
     ThreadPool.cpp
     RTags.cpp
@@ -79,7 +86,10 @@ set(rtags_client_SRCS
 
 set(rtags_HDRS
     ${rtags_client_HDRS}
+    BatchJob.h
     FindFileJob.h
+    CompilationDatabase.h
+    CompletionJob.h
     CursorInfoJob.h
     FindSymbolsJob.h
     FollowLocationJob.h
@@ -100,14 +110,21 @@ set(rtags_HDRS
     CursorInfo.h
     GRParser.h
     GRTags.h
+    Arena.h
     Indexer.h
+    UsrTable.h
     FileManager.h
+    Profiler.h
     Project.h
     RTagsClang.h
+    ResultCache.h
     )
 
 set(rtags_SRCS
     ${rtags_client_SRCS}
+    BatchJob.cpp
+    CompilationDatabase.cpp
+    CompletionJob.cpp
     CursorInfoJob.cpp
     FindFileJob.cpp
     FindSymbolsJob.cpp
@@ -119,6 +136,7 @@ set(rtags_SRCS
     Job.cpp
     ListSymbolsJob.cpp
     ReferencesJob.cpp
+    ResultCache.cpp
     StatusJob.cpp
     TestJob.cpp
     ValidateDBJob.cpp
@@ -131,7 +149,9 @@ set(rtags_SRCS
     GRTags.cpp
     GccArguments.cpp
     Indexer.cpp
+    UsrTable.cpp
     FileManager.cpp
+    Profiler.cpp
     Project.cpp
     RTagsClang.cpp
    )